@@ -0,0 +1,115 @@
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#include "../src/smack.h"
+
+/* Checks per second through smackmayaccess(), one after the other, and
+ * through smackasync with io_uring (where the kernel has it) and with
+ * its thread pool. No builtin rule decides the labels, so the kernel
+ * answers every check. Needs smackfs.
+ */
+
+#define CHECKS 100000
+#define LABELS 64
+
+static char subjects[LABELS][16];
+static char objects[LABELS][16];
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double start)
+{
+	printf("%-10s %10.0f checks/s\n", name, CHECKS / (now() - start));
+}
+
+static void blocking(void)
+{
+	double start = now();
+	unsigned i;
+
+	for (i = 0; i < CHECKS; ++i) {
+		errno = 0;
+		smackmayaccess(subjects[i % LABELS], objects[i / LABELS % LABELS],
+		               SMACK_MAY_R);
+		if (errno) {
+			perror("smackmayaccess");
+			exit(1);
+		}
+	}
+	report("blocking", start);
+}
+
+static void async(int flags)
+{
+	struct smackasync_result results[64];
+	struct smackasync *a;
+	struct pollfd pfd;
+	unsigned submitted = 0, completed = 0;
+	double start;
+	size_t i, n;
+
+	a = smackasync_open(0, flags);
+	if (!a) {
+		perror("smackasync_open");
+		exit(1);
+	}
+	pfd.fd = smackasync_fd(a);
+	pfd.events = POLLIN;
+
+	start = now();
+	while (completed < CHECKS) {
+		while (submitted < CHECKS &&
+		       smackasync_submit(a, subjects[submitted % LABELS],
+		                         objects[submitted / LABELS % LABELS],
+		                         SMACK_MAY_R, NULL) == 0)
+			++submitted;
+		if (submitted < CHECKS && errno != EAGAIN) {
+			perror("smackasync_submit");
+			exit(1);
+		}
+		while ((n = smackasync_complete(a, results, 64)) > 0) {
+			for (i = 0; i < n; ++i)
+				if (results[i].error) {
+					errno = results[i].error;
+					perror("smackasync");
+					exit(1);
+				}
+			completed += n;
+		}
+		if (completed < submitted)
+			poll(&pfd, 1, -1);
+	}
+	// io_uring falls back to the threads where the kernel lacks it
+	report(smackasync_flags(a) & SMACK_ASYNC_THREADS ? "threads" : "io_uring",
+	       start);
+	smackasync_close(a);
+}
+
+int main(void)
+{
+	unsigned n;
+
+	if (!(smackinterfaces() & SMACK_IFACE_MOUNTED)) {
+		printf("async: smackfs is not mounted, skipped\n");
+		return 0;
+	}
+	for (n = 0; n < LABELS; ++n) {
+		snprintf(subjects[n], sizeof(subjects[n]), "benchsub%u", n);
+		snprintf(objects[n], sizeof(objects[n]), "benchobj%u", n);
+	}
+	blocking();
+	async(0);
+	async(SMACK_ASYNC_THREADS);
+	return 0;
+}
@@ -0,0 +1,94 @@
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../src/smackint.h"
+
+/* Lookups per second of both decision caches, as the number of threads
+ * checking access at once grows. Every lookup hits: the kernel is never
+ * asked, so this measures the caches alone.
+ */
+
+#define PAIRS   1024
+#define LOOKUPS 2000000 // per thread
+#define MAXTHREADS 64
+
+static char subjects[PAIRS][16];
+static char objects[PAIRS][16];
+
+static void *worker(void *data)
+{
+	unsigned long i, seed = (unsigned long)data;
+	unsigned n;
+
+	for (i = 0; i < LOOKUPS; ++i) {
+		seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+		n = (unsigned)(seed >> 33) % PAIRS;
+		if (smack_cache_lookup(subjects[n], strlen(subjects[n]),
+		                       objects[n], strlen(objects[n]), SMACK_MAY_R) != 1)
+			abort();
+	}
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char *name, int flags, long maxthreads)
+{
+	pthread_t tids[MAXTHREADS];
+	double start, secs;
+	long threads, t;
+	unsigned n;
+
+	if (smackcache_enable2(4 << 20, flags) != 0) {
+		perror("smackcache_enable2");
+		exit(1);
+	}
+	smackcache_setinterval(0);
+	for (n = 0; n < PAIRS; ++n)
+		smack_cache_store(subjects[n], strlen(subjects[n]),
+		                  objects[n], strlen(objects[n]), SMACK_MAY_R, 1);
+
+	for (threads = 1; threads <= maxthreads; threads *= 2) {
+		start = now();
+		for (t = 0; t < threads; ++t)
+			if (pthread_create(&tids[t], NULL, worker, (void*)(t + 1)) != 0) {
+				perror("pthread_create");
+				exit(1);
+			}
+		for (t = 0; t < threads; ++t)
+			pthread_join(tids[t], NULL);
+		secs = now() - start;
+		printf("%-10s %3ld threads %8.2f Mlookups/s\n", name, threads,
+		       threads * (double)LOOKUPS / secs / 1e6);
+	}
+	smackcache_disable();
+}
+
+int main(void)
+{
+	long maxthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned n;
+
+	if (maxthreads < 1)
+		maxthreads = 1;
+	if (maxthreads > MAXTHREADS)
+		maxthreads = MAXTHREADS;
+	for (n = 0; n < PAIRS; ++n) {
+		snprintf(subjects[n], sizeof(subjects[n]), "subject%u", n % 37);
+		snprintf(objects[n], sizeof(objects[n]), "object%u", n);
+	}
+	run("locked", 0, maxthreads);
+	run("concurrent", SMACK_CACHE_CONCURRENT, maxthreads);
+	return 0;
+}
@@ -0,0 +1,128 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../src/smackint.h"
+
+/* The time a full load of the transition rules takes with 1, 2, 4 and
+ * 8 parsing threads, over a transition.d of many files.
+ */
+
+#define FILES  256
+#define RULES  2000 // per file
+#define ROUNDS 3
+
+static char tmpdir[] = "/tmp/benchreloadXXXXXX";
+static char dir[48];
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void path(char *out, size_t size, unsigned n)
+{
+	snprintf(out, size, "%s/%03u", dir, n);
+}
+
+static void writefiles(void)
+{
+	char name[64];
+	unsigned n, r;
+	FILE *fp;
+
+	for (n = 0; n < FILES; ++n) {
+		path(name, sizeof(name), n);
+		fp = fopen(name, "w");
+		if (!fp) {
+			perror(name);
+			exit(1);
+		}
+		for (r = 0; r < RULES; ++r)
+			fprintf(fp, "File%u_Subject%u -> File%u_Object%u\n", n, r, n, r % 50);
+		fclose(fp);
+	}
+}
+
+static void removefiles(void)
+{
+	char name[64];
+	unsigned n;
+
+	for (n = 0; n < FILES; ++n) {
+		path(name, sizeof(name), n);
+		unlink(name);
+	}
+	rmdir(dir);
+	rmdir(tmpdir);
+}
+
+// The best of a few full loads.
+static double load(void)
+{
+	struct smacktrans_ctx *ctx;
+	double start, secs, best = 0;
+	unsigned long before;
+	int round;
+
+	for (round = 0; round < ROUNDS; ++round) {
+		ctx = smacktrans_open("", dir);
+		if (!ctx) {
+			perror("smacktrans_open");
+			exit(1);
+		}
+		before = smack_trans_parses;
+		start = now();
+		if (smacktrans_reload(ctx) != 0) {
+			perror("smacktrans_reload");
+			exit(1);
+		}
+		secs = now() - start;
+		if (smack_trans_parses - before != FILES) {
+			fprintf(stderr, "reload: parsed %lu files, expected %u\n",
+			        smack_trans_parses - before, FILES);
+			exit(1);
+		}
+		smacktrans_close(ctx);
+		if (!round || secs < best)
+			best = secs;
+	}
+	return best;
+}
+
+int main(void)
+{
+	double base = 0, secs;
+	unsigned threads;
+
+	if (!mkdtemp(tmpdir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(dir, sizeof(dir), "%s/transition.d", tmpdir);
+	if (mkdir(dir, 0755) != 0) {
+		perror(dir);
+		return 1;
+	}
+	writefiles();
+
+	printf("%u files of %u rules, %ld CPUs\n", FILES, RULES,
+	       sysconf(_SC_NPROCESSORS_ONLN));
+	for (threads = 1; threads <= 8; threads *= 2) {
+		smack_trans_threads = threads;
+		secs = load();
+		if (threads == 1)
+			base = secs;
+		printf("%u threads %8.1f ms %5.2fx\n", threads, secs * 1e3, base / secs);
+	}
+
+	removefiles();
+	return 0;
+}
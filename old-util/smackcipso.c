@@ -36,7 +36,10 @@
 #include <string.h>
 #include <ctype.h>
 
+#include "../src/smack.h"
+
 #define LSIZE 23
+#define LLSIZE 255
 #define NSIZE 4
 #define MAXCATNUM 239
 #define MAXCATVAL 63
@@ -46,18 +49,22 @@ int
 writecipso(FILE *infp)
 {
 	int cipsofd;
-	char line[512];
-	char cipso[LSIZE + NSIZE + NSIZE + (NSIZE * MAXCATNUM)];
+	char line[LLSIZE + 1 + NSIZE + NSIZE + (NSIZE * MAXCATNUM)];
+	char cipso[LLSIZE + 1 + NSIZE + NSIZE + (NSIZE * MAXCATNUM) + 1];
 	char cats[MAXCATNUM+1][NSIZE+1];
 	char *cp;
 	int level;
 	int cat;
 	int i;
 	int err;
+	size_t labelend;
+	// use cipso2 right away if the kernel has it
+	int longfmt = (smackinterfaces() & SMACK_IFACE_CIPSO2) != 0;
+	const char *cipsofile = longfmt ? SMACK_CIPSO2 : SMACK_CIPSO;
 
-	cipsofd = open("/smack/cipso", O_RDWR);
+	cipsofd = open(cipsofile, O_RDWR);
 	if (cipsofd < 0) {
-		perror("opening /smack/cipso");
+		fprintf(stderr, "opening %s: %s\n", cipsofile, strerror(errno));
 		return -1;
 	}
 
@@ -74,10 +81,21 @@ writecipso(FILE *infp)
 			fprintf(stderr, "Empty line: \"%s\"\n", line);
 			continue;
 		}
-		sprintf(cipso, "%-23s ", line);
-		if (strlen(cipso) != 24) {
-			fprintf(stderr, "Bad label starting: \"%s\"\n", line);
-			continue;
+		if (longfmt) {
+			// long labels are not padded
+			labelend = strlen(line) + 1;
+			if (labelend > LLSIZE + 1) {
+				fprintf(stderr, "Bad label starting: \"%s\"\n", line);
+				continue;
+			}
+			sprintf(cipso, "%s ", line);
+		} else {
+			labelend = LSIZE + 1;
+			sprintf(cipso, "%-23s ", line);
+			if (strlen(cipso) != labelend) {
+				fprintf(stderr, "Bad label starting: \"%s\"\n", line);
+				continue;
+			}
 		}
 		cp = strtok(NULL, " \t");
 		if (cp == NULL) {
@@ -93,7 +111,7 @@ writecipso(FILE *infp)
 			fprintf(stderr, "Bad level: \"%s\"\n", cp);
 			continue;
 		}
-		sprintf(cipso+LSIZE+1, "%-4d", level);
+		sprintf(cipso+labelend, "%-4d", level);
 
 		cp = strtok(NULL, " \t");
 		for (i = 0; cp != NULL; cp = strtok(NULL, " \t"), i++) {
@@ -119,12 +137,12 @@ writecipso(FILE *infp)
 		if (err)
 			continue;
 
-		sprintf(cipso+LSIZE+1+NSIZE, "%-4d", i);
+		sprintf(cipso+labelend+NSIZE, "%-4d", i);
 		while (i > 0)
 			strcat(cipso, cats[--i]);
 		err = write(cipsofd, cipso, strlen(cipso));
 		if (err < 0)
-			perror("writing /smack/cipso");
+			fprintf(stderr, "writing %s: %s\n", cipsofile, strerror(errno));
 	}
 	return 0;
 }
@@ -36,11 +36,15 @@
 #include <string.h>
 #include <errno.h>
 
+#include "../src/smack.h"
+
 #define LSIZE 23
+#define LLSIZE 255
 #define ASIZE 5
 
 #define WRITE_NEW (LSIZE + LSIZE + ASIZE + 2)
 #define WRITE_OLD (WRITE_NEW - 1)
+#define WRITE_LONG (LLSIZE + LLSIZE + ASIZE + 2)
 
 static struct option opts[] = {
 	{"help",   no_argument, NULL, 'h'},
@@ -51,29 +55,33 @@ static struct option opts[] = {
 int writeload(FILE *infp, int clearflag)
 {
 	int loadfd;
-	char line[80];
-	char rule[WRITE_NEW + 1];
-	char subject[LSIZE + 1];
-	char object[LSIZE + 1];
+	char line[WRITE_LONG + 16];
+	char rule[WRITE_LONG + 1];
+	char subject[LLSIZE + 1];
+	char object[LLSIZE + 1];
 	char accesses[ASIZE + 1];
 	char real[ASIZE + 1];
 	char *cp;
 	int i;
 	int err;
 	int writesize = WRITE_NEW;
+	// use load2 right away if the kernel has it
+	int longfmt = (smackinterfaces() & SMACK_IFACE_LOAD2) != 0;
+	const char *loadfile = longfmt ? SMACK_LOAD2 : SMACK_LOAD;
+	const char *format = longfmt ? "%255s %255s %5s" : "%23s %23s %5s";
 
-	loadfd = open("/smack/load", O_RDWR);
+	loadfd = open(loadfile, O_RDWR);
 	if (loadfd < 0) {
-		perror("opening /smack/load");
+		fprintf(stderr, "opening %s: %s\n", loadfile, strerror(errno));
 		return -1;
 	}
 
-	while (fgets(line, 80, infp) != NULL) {
+	while (fgets(line, sizeof(line), infp) != NULL) {
 		err = 0;
 		if ((cp = strchr(line, '\n')) != NULL)
 			*cp = '\0';
 
-		if (sscanf(line,"%23s %23s %5s",subject,object,accesses) != 3) {
+		if (sscanf(line, format, subject, object, accesses) != 3) {
 			fprintf(stderr, "Bad input line \"%s\"\n", line);
 			continue;
 		}
@@ -118,6 +126,14 @@ int writeload(FILE *infp, int clearflag)
 			continue;
 		}
 
+		if (longfmt) {
+			writesize = sprintf(rule, "%s %s %s", subject, object, real);
+			err = write(loadfd, rule, writesize);
+			if (err != writesize)
+				fprintf(stderr, "writing %s: %s\n", loadfile, strerror(errno));
+			continue;
+		}
+
 		sprintf(rule, "%-23s %-23s %5s", subject, object, real);
 
 		if (writesize == WRITE_OLD && real[4] != '-')
@@ -139,6 +155,12 @@ int writeload(FILE *infp, int clearflag)
 		}
 		perror("writing /smack/load");
 	}
+
+	// decisions shared under the old rules must not be used any more
+	if (smackshmcache_attach(NULL, 0, 0) == 0) {
+		smackcache_invalidate();
+		smackshmcache_detach();
+	}
 	return 0;
 }
 
@@ -6,7 +6,13 @@
 
 static void usage(const char *arg0, FILE *target, int exitstatus)
 {
-	fprintf(target, "usage: %s < rules > output\n", arg0);
+	fprintf(target, "usage: %s [options] < rules > output\n", arg0);
+	fprintf(target,
+	"options:\n"
+	"  -h, --help            show this help message\n"
+	"  -l, --long            write the long format for " SMACK_LOAD2 "\n"
+	"  -a, --auto            write the long format if the kernel has " SMACK_LOAD2 "\n"
+	);
 	exit(exitstatus);
 }
 
@@ -16,24 +22,30 @@ static void usage(const char *arg0, FILE *target, int exitstatus)
                      (x) == '\f' || \
                      (x) == '\v' )
 
-static int extract(const char *arg0, char **start, char *target)
+static int extract(const char *arg0, char **start, char *target, int longfmt)
 {
 	size_t el = 0;
+	size_t size = longfmt ? SMACK_LONGLABEL : SMACK_SIZE;
 	char *pos = *start;
 	// Extract subject
-	while (*pos && !isspace(*pos) && el < SMACK_SIZE-1) {
+	while (*pos && !isspace(*pos) && el < size-1) {
 		target[el++] = *pos;
 		++pos;
 	}
 	// Check length
-	if (el == SMACK_SIZE-1) {
+	if (el == size-1) {
 		*pos = 0;
-		fprintf(stderr, "%s: label `%s' exceeds length limit\n"
-		        "For long labels there's no need to use this tool\n", arg0, *start);
+		if (longfmt)
+			fprintf(stderr, "%s: label `%s' exceeds length limit\n", arg0, *start);
+		else
+			fprintf(stderr, "%s: label `%s' exceeds length limit\n"
+			        "For long labels use the --long format\n", arg0, *start);
 		return 0;
 	}
 	// Fill up
-	while (el != SMACK_SIZE)
+	if (longfmt)
+		target[el] = 0;
+	else while (el != size)
 		target[el++] = ' ';
 	*start = pos;
 	return 1;
@@ -45,18 +57,30 @@ int main(int argc, char **argv)
 	size_t alen = 0;
 	ssize_t len;
 	int result = 0;
+	int longfmt = 0;
 
 	struct {
 		char subject[SMACK_SIZE];
 		char object[SMACK_SIZE];
 		char rwxat[5];
 	} rule;
+	char longsubject[SMACK_LONGLABEL];
+	char longobject[SMACK_LONGLABEL];
 
+	if (argc > 2)
+		usage(argv[0], stderr, 1);
 	if (argc > 1) {
 		if (!strcmp(argv[1], "-h") ||
 		    !strcmp(argv[1], "--help"))
 			usage(argv[0], stdout, 0);
-		usage(argv[0], stdout, 1);
+		else if (!strcmp(argv[1], "-l") ||
+		         !strcmp(argv[1], "--long"))
+			longfmt = 1;
+		else if (!strcmp(argv[1], "-a") ||
+		         !strcmp(argv[1], "--auto"))
+			longfmt = (smackinterfaces() & SMACK_IFACE_LOAD2) != 0;
+		else
+			usage(argv[0], stderr, 1);
 	}
 
 	while ((len = getline(&line, &alen, stdin)) >= 0)
@@ -78,7 +102,7 @@ int main(int argc, char **argv)
 		}
 
 		// read subject
-		if (!extract(argv[0], &pos, rule.subject)) {
+		if (!extract(argv[0], &pos, longfmt ? longsubject : rule.subject, longfmt)) {
 			result = 1;
 			continue;
 		}
@@ -94,7 +118,7 @@ int main(int argc, char **argv)
 		}
 
 		// read object
-		if (!extract(argv[0], &pos, rule.object)) {
+		if (!extract(argv[0], &pos, longfmt ? longobject : rule.object, longfmt)) {
 			result = 1;
 			continue;
 		}
@@ -170,7 +194,10 @@ int main(int argc, char **argv)
 		}
 		if (err)
 			continue;
-		write(1, (void*)&rule, sizeof(rule));
+		if (longfmt)
+			printf("%s %s %.5s\n", longsubject, longobject, rule.rwxat);
+		else
+			write(1, (void*)&rule, sizeof(rule));
 	}
 
 	return result;
@@ -25,6 +25,8 @@ static struct smackentry* newentry(const char *username)
 	entry->su_labelcount = 0;
 	entry->_su_allocated = 4;
 	entry->su_labels = (char**)malloc(sizeof(char*)*entry->_su_allocated);
+	entry->_su_ids = (smacklabel_id_t*)
+		malloc(sizeof(smacklabel_id_t)*entry->_su_allocated);
 	entry->su_any = 0;
 	return entry;
 }
@@ -39,7 +41,11 @@ static void addentry(struct smackentry *entry, const char *label)
 		entry->_su_allocated *= 2;
 		entry->su_labels = (char **)
 			realloc(entry->su_labels, sizeof(char*)*entry->_su_allocated);
+		entry->_su_ids = (smacklabel_id_t*)
+			realloc(entry->_su_ids, sizeof(smacklabel_id_t)*entry->_su_allocated);
 	}
+	// if interning fails, smackentrycontains_id() falls back to strcmp
+	entry->_su_ids[entry->su_labelcount] = smack_intern(label);
 	entry->su_labels[entry->su_labelcount++] = strdup(label);
 }
 
@@ -49,6 +55,7 @@ void closesmackentry(struct smackentry *entry)
 	for (i = 0; i < entry->su_labelcount; ++i)
 		free((void*)entry->su_labels[i]);
 	free((void*)entry->su_labels);
+	free((void*)entry->_su_ids);
 	free((void*)entry->su_name);
 	free((void*)entry);
 }
@@ -72,6 +79,23 @@ int smackentrycontains(struct smackentry const *entry, const char *label)
 	return 0;
 }
 
+int smackentrycontains_id(struct smackentry const *entry, smacklabel_id_t label)
+{
+	size_t i;
+	const char *name;
+	if (entry->su_any)
+		return 1;
+	for (i = 0; i < entry->su_labelcount; ++i) {
+		if (entry->_su_ids[i] == label)
+			return 1;
+		if (entry->_su_ids[i] == SMACK_LABEL_NONE &&
+		    (name = smack_labelname(label)) &&
+		    !strcmp(name, entry->su_labels[i]))
+			return 1;
+	}
+	return 0;
+}
+
 struct smackentry* opensmackentry(const char *username)
 {
 	FILE *fp;
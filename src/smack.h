@@ -2,11 +2,13 @@
 #define SMACK_H_
 
 #include <sys/types.h>
+#include <stdint.h>
 
 /* Predefined labels */
 #define SMACK_STAR "*"
 #define SMACK_FLOOR "_"
 #define SMACK_HAT "^"
+#define SMACK_WEB "@"
 
 #define SMACK_OACCESSLEN (sizeof("rwxa") - 1)
 #define SMACK_ACCESSLEN (sizeof("rwxat") - 1)
@@ -15,12 +17,17 @@
 #define SMACK_DEFAULT SMACK_FLOOR
 
 /* Control file locations */
-#define SMACK_LOAD "/smack/load"
-#define SMACK_CIPSO "/smack/cipso"
-#define SMACK_ACCESS "/smack/access"
+#define SMACK_FS "/smack"
+#define SMACK_LOAD SMACK_FS "/load"
+#define SMACK_CIPSO SMACK_FS "/cipso"
+#define SMACK_ACCESS SMACK_FS "/access"
+#define SMACK_LOAD2 SMACK_FS "/load2"
+#define SMACK_CIPSO2 SMACK_FS "/cipso2"
+#define SMACK_ACCESS2 SMACK_FS "/access2"
 
 #define SMACK_TRANSITION_FILE "/etc/smack/transition"
 #define SMACK_TRANSITION_DIR "/etc/smack/transition.d"
+#define SMACK_TRANSITION_DB "/etc/smack/transition.db"
 
 #define SMACK_PROCSELFATTRCURRENT "/proc/self/attr/current"
 
@@ -37,6 +44,25 @@
 #define SMACK_MAY_X (1<<2)
 #define SMACK_MAY_A (1<<3)
 #define SMACK_MAY_T (1<<4)
+#define SMACK_MAY_ALL (SMACK_MAY_R | SMACK_MAY_W | SMACK_MAY_X | \
+                       SMACK_MAY_A | SMACK_MAY_T)
+
+/* Kernel interfaces, see smackinterfaces() */
+#define SMACK_IFACE_MOUNTED   (1<<0)
+#define SMACK_IFACE_ACCESS2   (1<<1)
+#define SMACK_IFACE_LOAD2     (1<<2)
+#define SMACK_IFACE_CIPSO2    (1<<3)
+#define SMACK_IFACE_LONGLABEL (1<<4)
+
+/**
+ * An interned label.
+ * IDs are process wide, stay valid for the lifetime of the process
+ * and are equal exactly if the labels are equal.
+ */
+typedef uint32_t smacklabel_id_t;
+
+/* Never a valid label ID */
+#define SMACK_LABEL_NONE 0
 
 struct smackuser {
 	char *su_name; ///< The listed smack username.
@@ -49,6 +75,7 @@ struct smackentry {
 	size_t su_labelcount; ///< The number of labels stored in su_labels
 	int  su_any; ///< 1 if the user can take on any label
 	size_t _su_allocated;
+	smacklabel_id_t *_su_ids;
 };
 
 /* This function was written quite horribly, and is now replaced
@@ -92,11 +119,43 @@ const char *smackentryget(struct smackentry const * entry, size_t index);
  */
 int smackentrycontains(struct smackentry const * entry, const char *label);
 
+/**
+ * Test whether or not an interned label is listed.
+ * returns 1 if the label is listed or the '*ANY' label was added.
+ */
+int smackentrycontains_id(struct smackentry const * entry,
+                          smacklabel_id_t label);
+
 /**
  * Close an opened smackuser entry.
  */
 void closesmackentry(struct smackentry *entry);
 
+/**
+ * Intern a label.
+ * Returns the label's ID, or SMACK_LABEL_NONE with errno set:
+ * EINVAL - the label is too long.
+ * ENOMEM - out of memory.
+ * Interning is thread safe, interned labels are never released.
+ */
+smacklabel_id_t smack_intern(const char *label);
+
+/**
+ * Find the ID of an already interned label without interning it.
+ * Returns SMACK_LABEL_NONE if the label was never interned.
+ */
+smacklabel_id_t smack_labellookup(const char *label);
+
+/**
+ * Get the label an ID stands for, or NULL for an invalid ID.
+ */
+const char *smack_labelname(smacklabel_id_t id);
+
+/**
+ * Get the length of an interned label, or 0 for an invalid ID.
+ */
+size_t smack_labellen(smacklabel_id_t id);
+
 
 /**
  * Retrieve the smack label of the current process.
@@ -124,6 +183,15 @@ int setsmack(const char *label);
  */
 int smackenabled(void);
 
+/**
+ * Find out which smackfs interfaces the kernel provides.
+ * Returns a bitmask of SMACK_IFACE_* flags. Once smackfs was found,
+ * later calls return the same result without probing again; while it
+ * is not mounted, every call probes.
+ * Thread safe.
+ */
+int smackinterfaces(void);
+
 /* The following two functions will only be available
  * statically. NOT in the dynamic library, to avoid
  * LD_PRELOAD attacks.
@@ -159,19 +227,623 @@ int smackmayaccess(const char *subject, const char *object, int may);
  */
 int smackmayaccess2(const char *subject, const char *object, int may);
 
+/**
+ * Check if SMACK would allow access, with the label lengths given.
+ * The labels need not be NUL terminated. The request is built on the
+ * stack, no memory is allocated.
+ * On error, errno is set to something other than 0.
+ *
+ * This requires permission to read /smack/load.
+ */
+int smackaccess_n(const char *subject, size_t sublen,
+                  const char *object, size_t objlen,
+                  int may);
+
+/**
+ * Like smackaccess_n(), but try only the long interface.
+ */
+int smackaccess2_n(const char *subject, size_t sublen,
+                   const char *object, size_t objlen,
+                   int may);
+
+/**
+ * Get the access the subject has to the object, as a mask of
+ * SMACK_MAY_* bits each of which the kernel would allow on its own.
+ * Note that a "_" object or "^" subject get read and execute access
+ * from the builtin rules, which does not combine with access granted
+ * by rules in one request.
+ * Uses as few kernel requests as it can, and the decision cache when
+ * it is enabled.
+ * Returns -1 with errno set on error.
+ */
+int smackgetaccess(const char *subject, const char *object);
+
+/**
+ * Enable or disable answering requests which the kernel decides
+ * without its rule list in userspace: a "*" subject gets no access,
+ * equal labels and a "*" object allow any access, and a "_" object or
+ * a "^" subject allow read and execute. Enabled by default, unless the
+ * library was built with SMACK_NO_BUILTIN defined.
+ * This applies to smackaccess(), smackmayaccess() and their variants.
+ */
+void smackaccess_setbuiltin(int enable);
+
+/**
+ * Check if SMACK would allow the subject access to an open file.
+ * The file's label is cached by device, inode and ctime, so repeated
+ * checks of the same file do not read its label again; a relabeled
+ * file changes its ctime. Files without a label get SMACK_DEFAULT.
+ * The decision is taken from the decision cache when it is enabled,
+ * see smackcache_enable().
+ * On error, errno is set to something other than 0.
+ */
+int smackaccess_fd(const char *subject, int fd, int may);
+
+/**
+ * Like smackaccess_fd() for the file at @path, following symlinks.
+ */
+int smackaccess_path(const char *subject, const char *path, int may);
+
+/**
+ * Check the subject's access to many entries of the directory @dirfd
+ * (or the current directory, for AT_FDCWD) at once, eg. to filter a
+ * directory listing. out_allowed[i] is set to 1
+ * if the subject may access names[i] with all of @may, 0 otherwise.
+ * Symlinks are not followed, and entries without a label get
+ * SMACK_DEFAULT. Each distinct object label is only checked once.
+ * Returns the number of allowed entries, or -1 with errno set on error:
+ * EBADF - @dirfd is not an open file descriptor.
+ * ENOSYS - /proc is not mounted, so the labels cannot be read.
+ * ENOMEM - out of memory.
+ * and the errors of checking access.
+ */
+int smack_filter_paths(const char *subject, int dirfd,
+                       const char *const names[], size_t n,
+                       int may, unsigned char *out_allowed);
+
+/**
+ * Like smack_filter_paths(), reading the labels with up to @threads
+ * threads.
+ */
+int smack_filter_paths_mt(const char *subject, int dirfd,
+                          const char *const names[], size_t n,
+                          int may, unsigned char *out_allowed,
+                          int threads);
+
+/**
+ * Check if SMACK would allow access between interned labels.
+ *
+ * This requires permission to read /smack/load.
+ */
+int smackaccess_id(smacklabel_id_t subject, smacklabel_id_t object, int may);
+
+/**
+ * A session for repeated access checks.
+ * It keeps a handle on the smackfs mount, its scratch buffers and the
+ * knowledge of which access interface the kernel supports, so checks
+ * done through it do not pay for path lookups, allocations or failed
+ * long-interface attempts.
+ * A process which forks gets a fresh session state in the child the
+ * first time the session is used there.
+ * A session must not be used by multiple threads at once.
+ */
+struct smacksession;
+
+/**
+ * Open an access check session.
+ * Returns NULL with errno set on error:
+ * ENOSYS - smackfs is not mounted.
+ * ENOMEM - out of memory.
+ */
+struct smacksession *smacksession_open(void);
+
+/**
+ * Check if SMACK would allow access, like smackaccess().
+ * On error, errno is set to something other than 0.
+ */
+int smacksession_access(struct smacksession *session,
+                        const char *subject, const char *object,
+                        const char *access);
+
+/**
+ * Check if SMACK would allow access, like smackmayaccess().
+ * On error, errno is set to something other than 0.
+ */
+int smacksession_mayaccess(struct smacksession *session,
+                           const char *subject, const char *object,
+                           int may);
+
+/**
+ * Close a session opened with smacksession_open().
+ */
+void smacksession_close(struct smacksession *session);
+
+/**
+ * A single query of a batched access check.
+ */
+struct smackquery {
+	const char *subject; ///< The subject label.
+	const char *object; ///< The object label.
+	int may; ///< The requested access as SMACK_MAY_* bitmask.
+};
+
+/**
+ * Check a batch of queries through one session.
+ * For each query, results[i] is set to 1 if the access is allowed,
+ * 0 if it is denied, or to a negative errno value if the query itself
+ * failed (eg. -EINVAL for a label which is too long).
+ * Queries which are repeated within the batch are only passed to the
+ * kernel once.
+ * Returns the number of failed queries, or -1 with errno set if no
+ * query could be performed at all, in which case every result is set
+ * to -errno.
+ */
+int smackaccess_batch(const struct smackquery *queries, size_t n,
+                      int *results);
+
+/**
+ * Like smackaccess_batch(), using an already open session.
+ */
+int smacksession_batch(struct smacksession *session,
+                       const struct smackquery *queries, size_t n,
+                       int *results);
+
+/**
+ * A context for asynchronous access checks, for event loops which must
+ * not block on the kernel. Checks are submitted through io_uring where
+ * the kernel supports it, otherwise through a small pool of threads.
+ * A context must not be used by multiple threads at once, nor in a
+ * forked child.
+ */
+struct smackasync;
+
+/* smackasync_open() flags */
+#define SMACK_ASYNC_THREADS 1 ///< Use the thread pool even if io_uring works.
+
+/**
+ * The outcome of an asynchronous check.
+ */
+struct smackasync_result {
+	void *cookie; ///< The cookie passed to smackasync_submit().
+	int allowed; ///< 1 if the access is allowed, 0 otherwise.
+	int error; ///< 0, or the errno value of a failed check.
+};
+
+/**
+ * Open an asynchronous check context with up to @depth checks in
+ * flight (0 for a default of 256, at most 4096).
+ * Returns NULL with errno set on error:
+ * ENOSYS - smackfs is not mounted.
+ * EINVAL - depth is too large.
+ * ENOMEM - out of memory.
+ */
+struct smackasync *smackasync_open(unsigned depth, int flags);
+
+/**
+ * Get the eventfd which becomes readable when checks have completed,
+ * to be polled with epoll() or poll().
+ */
+int smackasync_fd(struct smackasync *async);
+
+/**
+ * Get the flags a context works with: SMACK_ASYNC_THREADS if checks go
+ * through the thread pool, whether it was asked for or io_uring does
+ * not work.
+ */
+int smackasync_flags(struct smackasync *async);
+
+/**
+ * Submit a check of the subject's access to the object, with the
+ * requested access as SMACK_MAY_* bitmask. Its result is returned by
+ * smackasync_complete() together with @cookie. Checks answered by the
+ * builtin rules or the decision caches complete right away.
+ * Returns 0 on success, -1 with errno set on error:
+ * EAGAIN - depth checks are in flight, reap some first.
+ * EINVAL - a label is too long.
+ * ENOSYS - the access interface is missing.
+ */
+int smackasync_submit(struct smackasync *async,
+                      const char *subject, const char *object,
+                      int may, void *cookie);
+
+/**
+ * Collect up to @max completed checks into @results, without blocking.
+ * Returns the number of results stored.
+ */
+size_t smackasync_complete(struct smackasync *async,
+                           struct smackasync_result *results, size_t max);
+
+/**
+ * Close a context, waiting for the checks still in flight.
+ */
+void smackasync_close(struct smackasync *async);
+
+
+/**
+ * Counters of the access decision cache.
+ */
+struct smackcachestats {
+	unsigned long hits; ///< Lookups answered from the cache.
+	unsigned long misses; ///< Lookups which had to ask the kernel.
+	unsigned long evictions; ///< Entries dropped to stay within budget.
+	unsigned long invalidations; ///< Times the whole cache was dropped.
+	size_t entries; ///< Number of cached subject/object pairs.
+	size_t memory; ///< Bytes currently used by the cache.
+};
+
+/**
+ * Enable the process wide decision cache used by smackaccess() and
+ * smackmayaccess(), using at most @bytes of memory (0 for a default of
+ * 256KiB). Both allowed and denied decisions are cached, the least
+ * recently used pairs are evicted first.
+ * If enabled again, the cache is emptied and resized.
+ * Returns 0 on success, -1 with errno set on error.
+ */
+int smackcache_enable(size_t bytes);
+
+/**
+ * Flag for smackcache_enable2(): use the concurrent cache, which
+ * answers lookups without taking a lock and is meant for processes
+ * checking access from many threads at once.
+ */
+#define SMACK_CACHE_CONCURRENT 1
+
+/**
+ * Like smackcache_enable(), with flags selecting the kind of cache.
+ * Without flags, this is smackcache_enable(). With
+ * SMACK_CACHE_CONCURRENT, lookups are lock free and inserts only lock
+ * one of several shards. Instead of evicting single entries, the
+ * concurrent cache drops all its entries when a shard runs out of
+ * budget.
+ * Returns 0 on success, -1 with errno set on error.
+ */
+int smackcache_enable2(size_t bytes, int flags);
+
+/**
+ * Disable the decision cache and release its memory.
+ */
+void smackcache_disable(void);
+
+/**
+ * Set how often, in milliseconds, the cache checks whether the loaded
+ * policy changed by fingerprinting /smack/load2. Defaults to 1000.
+ * With 0, the cache is only dropped by smackcache_invalidate().
+ * This requires permission to read /smack/load2.
+ */
+void smackcache_setinterval(unsigned ms);
+
+/**
+ * Drop all cached decisions, eg. after loading new rules. This includes
+ * those shared through smackshmcache_attach() by all processes.
+ */
+void smackcache_invalidate(void);
+
+/**
+ * Get the cache's counters.
+ */
+void smackcache_stats(struct smackcachestats *stats);
+
+/* The default location of the shared decision cache */
+#define SMACK_SHMCACHE "/run/smack/access.cache"
+
+/**
+ * Flag for smackshmcache_attach(): create the cache file if it does
+ * not exist.
+ */
+#define SMACK_SHMCACHE_CREATE 1
+
+/**
+ * Share access decisions with other processes through a mapped file,
+ * SMACK_SHMCACHE if @path is NULL. The file is only used if it is owned
+ * by root and not writable by group or others, and only root creates
+ * it. Processes which cannot write to it only read from it.
+ * NOTE: The decisions in the file are trusted because of its owner,
+ * not the label of the process which stored them: every root process
+ * which Smack lets write the file can make others take its decisions.
+ * Label the file so that only trusted writers have write access.
+ * @slots is the number of pairs a newly created file can hold, 0 for
+ * the default of 4096. Decisions are only shared for pairs whose labels
+ * are no longer than 102 bytes together. After loading new rules, a
+ * process which can write the file must call smackcache_invalidate(),
+ * which drops the shared decisions of all processes; smackload does.
+ * Rules written to smackfs by other means leave stale decisions in the
+ * file until then.
+ * Returns 0 on success, -1 with errno set on error.
+ */
+int smackshmcache_attach(const char *path, size_t slots, int flags);
+
+/**
+ * Stop using the shared decision cache.
+ */
+void smackshmcache_detach(void);
+
+/**
+ * A snapshot of access rules which can be checked without asking the
+ * kernel, see smackpolicy_open().
+ */
+struct smackpolicy;
+
+/**
+ * Load access rules into a policy snapshot.
+ * @path is a file in the format of /smack/load2 or of smackgenload's
+ * input: "subject object access" lines. With NULL, the kernel's current
+ * rule list is read, which requires permission to read /smack/load2.
+ * Invalid lines are reported on stderr and skipped.
+ * Returns NULL with errno set on error.
+ */
+struct smackpolicy *smackpolicy_open(const char *path);
+
+/**
+ * Check if the policy allows access, with the same semantics as the
+ * kernel, including the builtin rules for "*", "@", "_" and "^" labels.
+ * Thread safe, the policy is not modified.
+ */
+int smackpolicy_check(struct smackpolicy *policy,
+                      const char *subject, const char *object, int may);
+
+/**
+ * Like smackpolicy_check() for interned labels.
+ */
+int smackpolicy_check_id(struct smackpolicy *policy,
+                         smacklabel_id_t subject, smacklabel_id_t object,
+                         int may);
+
+/**
+ * Enable or disable the verify mode: every check is also passed to the
+ * kernel, differing answers are reported on stderr and counted, and
+ * the kernel's answer is returned.
+ */
+void smackpolicy_setverify(struct smackpolicy *policy, int enable);
+
+/**
+ * The number of mismatches found in verify mode.
+ */
+unsigned long smackpolicy_mismatches(const struct smackpolicy *policy);
+
+/**
+ * The number of distinct subject/object rules in the policy.
+ */
+size_t smackpolicy_rulecount(const struct smackpolicy *policy);
+
+/**
+ * Get the access the policy gives the subject to the object, like
+ * smackgetaccess() does for the kernel's rules.
+ */
+int smackpolicy_getaccess(const struct smackpolicy *policy,
+                          const char *subject, const char *object);
+
+/**
+ * Like smackpolicy_getaccess() for interned labels.
+ */
+int smackpolicy_getaccess_id(const struct smackpolicy *policy,
+                             smacklabel_id_t subject, smacklabel_id_t object);
+
+/**
+ * List the objects the subject has rules granting all of @may for.
+ * At most @max IDs are stored in @out, sorted by ID. Returns the total
+ * number of matching objects, which may be more than @max.
+ * Only explicit rules are listed, not the builtin ones.
+ */
+size_t smackpolicy_objects(const struct smackpolicy *policy,
+                           smacklabel_id_t subject, int may,
+                           smacklabel_id_t *out, size_t max);
+
+/**
+ * List the subjects which have rules granting all of @may for the
+ * object, like smackpolicy_objects().
+ */
+size_t smackpolicy_subjects(const struct smackpolicy *policy,
+                            smacklabel_id_t object, int may,
+                            smacklabel_id_t *out, size_t max);
+
+/**
+ * Release a policy snapshot.
+ */
+void smackpolicy_close(struct smackpolicy *policy);
+
+/**
+ * A dense bitset form of a policy snapshot, answering "which objects
+ * may this subject access" with a few wide AND operations.
+ * Rows and columns are label IDs: bit o of a row (word o/64, bit o%64)
+ * stands for the label with ID o.
+ * It needs 6 bits for each pair of labels the policy knows of.
+ */
+struct smackmatrix;
+
+/**
+ * Build a bitset matrix from a policy snapshot.
+ * Returns NULL with errno set on error.
+ */
+struct smackmatrix *smackmatrix_build(const struct smackpolicy *policy);
+
+/**
+ * The number of 64 bit words in a row of the matrix, which is the
+ * size of the buffers passed to smackmatrix_row() and
+ * smackmatrix_filter().
+ */
+size_t smackmatrix_words(const struct smackmatrix *matrix);
+
+/**
+ * Set out to the objects the subject may access with all of @may.
+ */
+void smackmatrix_row(const struct smackmatrix *matrix,
+                     smacklabel_id_t subject, int may, uint64_t *out);
+
+/**
+ * Set out to the objects among @candidates the subject may access with
+ * all of @may.
+ */
+void smackmatrix_filter(const struct smackmatrix *matrix,
+                        smacklabel_id_t subject, int may,
+                        const uint64_t *candidates, uint64_t *out);
+
+/**
+ * Check a single pair, like smackpolicy_check_id().
+ */
+int smackmatrix_check(const struct smackmatrix *matrix,
+                      smacklabel_id_t subject, smacklabel_id_t object,
+                      int may);
+
+/**
+ * Release a bitset matrix.
+ */
+void smackmatrix_free(struct smackmatrix *matrix);
 
 /**
  * Check if a label-transition is allowed by /etc/transition.d/...
  * This does not include an execute-access check!
  * You generally want to additionally do smackaccess(sub, obj, "x")
  * as well.
- * NOTE: While some caching is performed, each function call will
- *       still check the mtime of all transition related config
- *       files, and if a file changed, the whole set of rules is
- *       reloaded.
+ * NOTE: The rules are cached. Each call checks the size and mtime of
+ *       all transition related config files, and only files which
+ *       were added or changed are read again. Long running processes
+ *       can have changes noticed through inotify instead, see
+ *       smackconfig_watch() and smackconfig_watch_fd().
+ * NOTE: If a database compiled with smacktrans_compile() is newer
+ *       than all of the files, it is used instead of them.
  * NOTE: Do not rely on this function in a dynamically linked
  *       executable!
+ * It may be called by multiple threads at once.
  */
 int smackchecktrans(const char *subject, const char *object);
 
+/**
+ * Like smackchecktrans() for interned labels.
+ */
+int smackchecktrans_id(smacklabel_id_t subject, smacklabel_id_t object);
+
+/**
+ * A set of transition rules read from a transition file and directory,
+ * for checks which do not use the default configuration. Contexts may
+ * be used by multiple threads at once: the rules are replaced as a
+ * whole when the files change, so checks never wait for a reload.
+ */
+struct smacktrans_ctx;
+
+/**
+ * Open a context reading the rules from @file and the files in @dir,
+ * which must be absolute paths. NULL selects the default path, an
+ * empty string none.
+ * Returns NULL with errno set on error:
+ * EINVAL - a path is not absolute.
+ * ENOMEM - out of memory.
+ */
+struct smacktrans_ctx *smacktrans_open(const char *file, const char *dir);
+
+/**
+ * Check if a label-transition is allowed, like smackchecktrans().
+ */
+int smacktrans_check(struct smacktrans_ctx *ctx,
+                     const char *subject, const char *object);
+
+/**
+ * Read changed files now instead of on the next check.
+ * Returns 0 on success, -1 with errno set on error.
+ */
+int smacktrans_reload(struct smacktrans_ctx *ctx);
+
+/**
+ * Close a context opened with smacktrans_open(), once no other thread
+ * uses it anymore.
+ */
+void smacktrans_close(struct smacktrans_ctx *ctx);
+
+/**
+ * Compile the rules of @file and the files in @dir into the binary
+ * database @db, which smackchecktrans() maps and queries in place
+ * while it is newer than the files. NULL selects the default paths,
+ * an empty @file or @dir none. The database is replaced atomically.
+ * Returns the number of rules, or -1 with errno set on error:
+ * EINVAL - a rule path is not absolute, or @db is empty.
+ * EBADMSG - a rule file has syntax errors, which are printed to
+ *           stderr. The database is not replaced.
+ * ENOMEM - out of memory.
+ * and the errors of creating and writing the database.
+ */
+int smacktrans_compile(const char *file, const char *dir, const char *db);
+
+/* smacktrans_compile2() flags */
+#define SMACK_TRANS_FORCE 1 ///< Compile even if the rule files have errors.
+
+/**
+ * Like smacktrans_compile(), with flags. Without SMACK_TRANS_FORCE,
+ * rule files with syntax errors fail with EBADMSG and leave the
+ * database as it is; with it, the lines in error are left out.
+ */
+int smacktrans_compile2(const char *file, const char *dir, const char *db,
+                        int flags);
+
+/**
+ * Transitive reachability over the transition rules: which labels a
+ * process can eventually reach through chains of transitions. The
+ * strongly connected components of the rules' graph are condensed and
+ * the transitive closure computed as bitsets, once whenever the rules
+ * change. Patterns connect the labels named in the rules which they
+ * match. Queries may be made by multiple threads at once.
+ */
+struct smackreach;
+
+/**
+ * Open a reachability index over the rules of @ctx, which must stay
+ * open while it is used, or over those of smackchecktrans() for NULL.
+ * Returns NULL with errno set on error:
+ * EINVAL - the default transition paths are invalid.
+ * ENOMEM - out of memory.
+ */
+struct smackreach *smackreach_open(struct smacktrans_ctx *ctx);
+
+/**
+ * Check if @to can be reached from @from through one or more
+ * transitions, or is @from. Takes constant time for labels named in the
+ * rules, others are matched against the patterns.
+ */
+int smackreach_check(struct smackreach *reach, const char *from, const char *to);
+
+/**
+ * List the labels named in the rules which can be reached from @from,
+ * including @from only if a chain of transitions leads back to it.
+ * At most @max IDs are stored in @out, sorted by ID. Returns the total
+ * number of reachable labels, which may be more than @max.
+ */
+size_t smackreach_list(struct smackreach *reach, const char *from,
+                       smacklabel_id_t *out, size_t max);
+
+/**
+ * List the labels named in the rules, like smackreach_list().
+ */
+size_t smackreach_labels(struct smackreach *reach,
+                         smacklabel_id_t *out, size_t max);
+
+/**
+ * Release a reachability index.
+ */
+void smackreach_close(struct smackreach *reach);
+
+/**
+ * Notice changes to the transition config files of all contexts through
+ * inotify, with a thread waiting for its events, instead of checking
+ * the files on every call.
+ * Returns 0, or -1 with errno set to ENOSYS if the files cannot be
+ * watched.
+ */
+int smackconfig_watch(void);
+
+/**
+ * Get the inotify descriptor watching the transition config files, for
+ * applications which want to poll it in their own event loop. When it
+ * becomes readable, call smackconfig_process(). No watcher thread is
+ * started once this was called.
+ * Returns -1 with errno set to ENOSYS if the files cannot be watched.
+ * NOTE: In a forked child, call this again for the child's descriptor.
+ */
+int smackconfig_watch_fd(void);
+
+/**
+ * Process the pending events of smackconfig_watch_fd(), and reload the
+ * transition rules if they changed.
+ * Returns 1 if the rules were reloaded, 0 if nothing changed, or -1
+ * with errno set on error.
+ */
+int smackconfig_process(void);
+
 #endif /* !SMACK_H_ */
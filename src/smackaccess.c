@@ -20,9 +20,43 @@
 #include <string.h>
 #include <errno.h>
 
-#include "smack.h"
+#include "smackint.h"
 
-static int parseaccess(char *access, char *out)
+#ifndef SMACK_NO_BUILTIN
+static int usebuiltin = 1;
+#endif
+
+void smackaccess_setbuiltin(int enable)
+{
+#ifndef SMACK_NO_BUILTIN
+	__atomic_store_n(&usebuiltin, enable, __ATOMIC_RELAXED);
+#else
+	(void)enable;
+#endif
+}
+
+/* Decide requests the kernel decides without its rule list.
+ * Returns -1 if the kernel has to be asked.
+ */
+static int builtin(const char *subject, size_t sublen,
+                   const char *object, size_t objlen,
+                   int may)
+{
+#ifndef SMACK_NO_BUILTIN
+	int rc;
+
+	if (!__atomic_load_n(&usebuiltin, __ATOMIC_RELAXED))
+		return -1;
+	rc = smack_builtin(subject, sublen, object, objlen, may);
+	if (rc >= 0)
+		errno = 0;
+	return rc;
+#else
+	return -1;
+#endif
+}
+
+int smack_parseaccess(const char *access, char *out)
 {
 	int i;
 
@@ -62,60 +96,53 @@ static int parseaccess(char *access, char *out)
 	return 0;
 }
 
-int smackaccess2(const char *subject, const char *object, char *access)
+size_t smack_request_long(char *buf,
+                          const char *subject, size_t sublen,
+                          const char *object, size_t objlen,
+                          const char *rwxat)
 {
-	char *buffer;
-	char *accesspart;
-	size_t sublen, objlen, bufsize;
-	char reply[16];
-
-	int fd;
-
-	errno = 0;
-
-	sublen = strlen(subject);
-	if (sublen >= SMACK_LONGLABEL-1) {
-		errno = EINVAL;
-		return 0;
-	}
-	objlen = strlen(object);
-	if (objlen >= SMACK_LONGLABEL-1) {
-		errno = EINVAL;
-		return 0;
-	}
-
-	bufsize = sublen + 1 + objlen + 1 + 5;
-	buffer = (char*)malloc(bufsize);
+	memcpy(buf, subject, sublen);
+	buf[sublen] = ' ';
+	memcpy(buf + sublen + 1, object, objlen);
+	buf[sublen + 1 + objlen] = ' ';
+	memcpy(buf + sublen + 1 + objlen + 1, rwxat, SMACK_ACCESSLEN);
+	return sublen + 1 + objlen + 1 + SMACK_ACCESSLEN;
+}
 
-	strcpy(buffer, subject);
-	strcpy(buffer + sublen + 1, object);
-	accesspart = buffer + sublen + 1 + objlen + 1;
+size_t smack_request_legacy(char *buf,
+                            const char *subject, size_t sublen,
+                            const char *object, size_t objlen,
+                            const char *rwxat)
+{
+	memset(buf, 0, SMACK_SIZE + SMACK_SIZE);
+	memcpy(buf, subject, sublen);
+	memcpy(buf + SMACK_SIZE, object, objlen);
+	memcpy(buf + SMACK_SIZE + SMACK_SIZE, rwxat, SMACK_ACCESSLEN);
+	return SMACK_SIZE + SMACK_SIZE + SMACK_ACCESSLEN;
+}
 
-	if (parseaccess(access, accesspart) != 0) {
-		free(buffer);
-		errno = EINVAL;
-		return 0;
-	}
+int smack_transact(int dirfd, const char *path,
+                   const char *request, size_t size)
+{
+	int fd;
+	ssize_t rc;
+	char reply[16];
 
-	fd = open(SMACK_ACCESS, O_RDWR);
+	fd = openat(dirfd, path, O_RDWR | O_CLOEXEC);
 	if (fd < 0) {
-		int eno = errno;
-		free(buffer);
-		errno = eno;
 		if (errno == ENOENT)
 			errno = ENOSYS;
-		return 0;
+		return -1;
 	}
 
-	if (bufsize != write(fd, buffer, bufsize)) {
-		free(buffer);
-		errno = EINVAL;
+	rc = write(fd, request, size);
+	if (rc < 0 || (size_t)rc != size) {
 		close(fd);
-		return 0;
+		errno = EINVAL;
+		return -1;
 	}
-	free(buffer);
 
-	if (read(fd, &reply, sizeof(reply)) < 1) {
+	if (read(fd, reply, sizeof(reply)) < 1) {
 		close(fd);
 		errno = 0;
 		return 0;
@@ -125,69 +152,141 @@ int smackaccess2(const char *subject, const char *object, char *access)
 	return (reply[0] == '1') ? 1 : 0;
 }
 
-int smackaccess(const char *subject, const char *object, char *access)
+static int access2_n(const char *subject, size_t sublen,
+                     const char *object, size_t objlen,
+                     const char *rwxat)
 {
+	char request[SMACK_REQUESTSIZE];
+	size_t size;
 	int rc;
-	union {
-		struct {
-			char subject[SMACK_SIZE];
-			char object[SMACK_SIZE];
-			char access[SMACK_ACCESSLEN];
-		} data;
-		char result;
-	} data;
-
-	int fd;
-	int i;
-
-	rc = smackaccess2(subject, object, access);
-	if (!errno)
-		return rc;
 
 	errno = 0;
 
-	memset(&data, 0, sizeof(data));
-	for (i = 0; i < 5; ++i)
-		data.data.access[i] = '-';
-
-	if (strlen(subject) >= SMACK_SIZE-1)
-	{
+	if (sublen >= SMACK_LONGLABEL-1 || objlen >= SMACK_LONGLABEL-1) {
 		errno = EINVAL;
 		return 0;
 	}
 
-	if (strlen(object) >= SMACK_SIZE-1)
-	{
-		errno = EINVAL;
-		return 0;
-	}
+	size = smack_request_long(request, subject, sublen, object, objlen, rwxat);
+	rc = smack_transact(AT_FDCWD, SMACK_ACCESS2, request, size);
+	return rc < 0 ? 0 : rc;
+}
 
-	strncpy(data.data.subject, subject, sizeof(data.data.subject));
-	strncpy(data.data.object, object, sizeof(data.data.object));
-	if (parseaccess(access, data.data.access) != 0) {
+static int access_n(const char *subject, size_t sublen,
+                    const char *object, size_t objlen,
+                    const char *rwxat)
+{
+	char request[SMACK_SIZE + SMACK_SIZE + SMACK_ACCESSLEN];
+	size_t size;
+	int rc;
+
+	// Don't bother with the old interface if the new one exists.
+	if (smackinterfaces() & SMACK_IFACE_ACCESS2)
+		return access2_n(subject, sublen, object, objlen, rwxat);
+
+	errno = 0;
+
+	if (sublen >= SMACK_SIZE-1 || objlen >= SMACK_SIZE-1) {
 		errno = EINVAL;
 		return 0;
 	}
 
-	fd = open(SMACK_ACCESS, O_RDWR);
-	if (fd < 0) {
-		if (errno == ENOENT)
-			errno = ENOSYS;
-		return 0;
+	size = smack_request_legacy(request, subject, sublen, object, objlen, rwxat);
+	rc = smack_transact(AT_FDCWD, SMACK_ACCESS, request, size);
+	return rc < 0 ? 0 : rc;
+}
+
+int smackaccess2_n(const char *subject, size_t sublen,
+                   const char *object, size_t objlen,
+                   int may)
+{
+	char rwxat[SMACK_ACCESSLEN];
+	int rc;
+
+	rc = builtin(subject, sublen, object, objlen, may);
+	if (rc >= 0)
+		return rc;
+	smack_setaccess(may, rwxat);
+	return access2_n(subject, sublen, object, objlen, rwxat);
+}
+
+int smack_access_known(const char *subject, size_t sublen,
+                       const char *object, size_t objlen,
+                       int may)
+{
+	int rc;
+
+	rc = builtin(subject, sublen, object, objlen, may);
+	if (rc >= 0)
+		return rc;
+	if (smack_cache_enabled) {
+		rc = smack_cache_lookup(subject, sublen, object, objlen, may);
+		if (rc >= 0) {
+			errno = 0;
+			return rc;
+		}
 	}
+	if (smack_shmcache_attached) {
+		rc = smack_shmcache_lookup(subject, sublen, object, objlen, may);
+		if (rc >= 0) {
+			if (smack_cache_enabled)
+				smack_cache_store(subject, sublen, object, objlen, may, rc);
+			errno = 0;
+			return rc;
+		}
+	}
+	return -1;
+}
 
-	if (sizeof(data) != write(fd, &data, sizeof(data))) {
+void smack_access_learn(const char *subject, size_t sublen,
+                        const char *object, size_t objlen,
+                        int may, int allowed)
+{
+	if (smack_cache_enabled)
+		smack_cache_store(subject, sublen, object, objlen, may, allowed);
+	if (smack_shmcache_attached)
+		smack_shmcache_store(subject, sublen, object, objlen, may, allowed);
+}
+
+int smackaccess_n(const char *subject, size_t sublen,
+                  const char *object, size_t objlen,
+                  int may)
+{
+	char rwxat[SMACK_ACCESSLEN];
+	int rc;
+
+	rc = smack_access_known(subject, sublen, object, objlen, may);
+	if (rc >= 0)
+		return rc;
+
+	smack_setaccess(may, rwxat);
+	rc = access_n(subject, sublen, object, objlen, rwxat);
+	if (errno)
+		return rc;
+	smack_access_learn(subject, sublen, object, objlen, may, rc);
+	return rc;
+}
+
+int smackaccess2(const char *subject, const char *object, char *access)
+{
+	char rwxat[SMACK_ACCESSLEN];
+
+	if (smack_parseaccess(access, rwxat) != 0) {
 		errno = EINVAL;
-		close(fd);
 		return 0;
 	}
+	return smackaccess2_n(subject, strlen(subject), object, strlen(object),
+	                      smack_accessmask(rwxat));
+}
 
-	if (read(fd, &data, sizeof(data)) < 1) {
-		close(fd);
-		errno = 0;
+int smackaccess(const char *subject, const char *object, char *access)
+{
+	char rwxat[SMACK_ACCESSLEN];
+
+	if (smack_parseaccess(access, rwxat) != 0) {
+		errno = EINVAL;
 		return 0;
 	}
-	close(fd);
-
-	return (data.result == '1') ? 1 : 0;
+	return smackaccess_n(subject, strlen(subject), object, strlen(object),
+	                     smack_accessmask(rwxat));
 }
@@ -0,0 +1,612 @@
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#ifdef __NR_io_uring_setup
+# include <linux/io_uring.h>
+# define ASYNC_URING 1
+#endif
+
+#include "smackint.h"
+
+#define ASYNC_DEFAULTDEPTH 256
+#define ASYNC_MAXDEPTH     4096
+#define ASYNC_THREADS      4
+
+// user_data of the read completing a request
+#define ASYNC_READTAG      1
+
+typedef struct asyncreq_s {
+	struct asyncreq_s *next;
+	void   *cookie;
+	int     fd;        // the open access file of the io_uring backend
+	int     pending;   // completions still to come
+	int     allowed;
+	int     error;
+	int     may;
+	size_t  size;      // of the request
+	size_t  objoff;    // where the object label starts in the request
+	size_t  sublen;
+	size_t  objlen;
+	char    request[SMACK_REQUESTSIZE];
+	char    reply[16];
+} asyncreq_t;
+
+#ifdef ASYNC_URING
+typedef struct ring_s {
+	int                  fd;
+	void                *sqmap;
+	size_t               sqmapsize;
+	void                *cqmap;
+	size_t               cqmapsize;
+	struct io_uring_sqe *sqes;
+	size_t               sqessize;
+	unsigned            *sqhead;
+	unsigned            *sqtail;
+	unsigned            *sqarray;
+	unsigned             sqmask;
+	unsigned             sqentries;
+	unsigned            *cqhead;
+	unsigned            *cqtail;
+	unsigned             cqmask;
+	struct io_uring_cqe *cqes;
+	unsigned             inflight; // requests the kernel still works on
+} ring_t;
+#endif
+
+struct smackasync {
+	int              evfd;
+	int              dirfd;
+	int              longiface;
+	unsigned         depth;
+	asyncreq_t      *reqs;
+	pthread_mutex_t  lock;      // protects the lists below
+	asyncreq_t      *free;      // requests not in use
+	asyncreq_t      *done;      // finished requests not reaped yet
+	asyncreq_t     **donetail;
+#ifdef ASYNC_URING
+	ring_t           ring;
+	int              uring;
+#endif
+	// the thread pool backend
+	pthread_cond_t   wake;
+	asyncreq_t      *queue;
+	asyncreq_t     **queuetail;
+	pthread_t        workers[ASYNC_THREADS];
+	int              nworkers;
+	int              stop;
+};
+
+static void signal_ready(struct smackasync *a)
+{
+	uint64_t one = 1;
+
+	if (write(a->evfd, &one, sizeof(one)) < 0) {
+		// the counter cannot overflow with at most depth requests
+	}
+}
+
+// Remember what the kernel decided.
+static void learn(asyncreq_t *r)
+{
+	if (!r->error)
+		smack_access_learn(r->request, r->sublen,
+		                   r->request + r->objoff, r->objlen,
+		                   r->may, r->allowed);
+}
+
+static void finish(struct smackasync *a, asyncreq_t *r)
+{
+	pthread_mutex_lock(&a->lock);
+	r->next = NULL;
+	*a->donetail = r;
+	a->donetail = &r->next;
+	pthread_mutex_unlock(&a->lock);
+	signal_ready(a);
+}
+
+#ifdef ASYNC_URING
+static int ring_setup(ring_t *ring, unsigned entries)
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0)
+		return -1;
+
+	ring->sqmapsize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cqmapsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cqmapsize > ring->sqmapsize)
+			ring->sqmapsize = ring->cqmapsize;
+		ring->cqmapsize = ring->sqmapsize;
+	}
+
+	ring->sqmap = mmap(NULL, ring->sqmapsize, PROT_READ | PROT_WRITE,
+	                   MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sqmap == MAP_FAILED)
+		goto out_fd;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->cqmap = ring->sqmap;
+	else {
+		ring->cqmap = mmap(NULL, ring->cqmapsize, PROT_READ | PROT_WRITE,
+		                   MAP_SHARED | MAP_POPULATE, ring->fd,
+		                   IORING_OFF_CQ_RING);
+		if (ring->cqmap == MAP_FAILED)
+			goto out_sq;
+	}
+	ring->sqessize = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqessize,
+	                                        PROT_READ | PROT_WRITE,
+	                                        MAP_SHARED | MAP_POPULATE,
+	                                        ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		goto out_cq;
+
+	ring->sqhead = (unsigned*)((char*)ring->sqmap + p.sq_off.head);
+	ring->sqtail = (unsigned*)((char*)ring->sqmap + p.sq_off.tail);
+	ring->sqarray = (unsigned*)((char*)ring->sqmap + p.sq_off.array);
+	ring->sqmask = *(unsigned*)((char*)ring->sqmap + p.sq_off.ring_mask);
+	ring->sqentries = p.sq_entries;
+	ring->cqhead = (unsigned*)((char*)ring->cqmap + p.cq_off.head);
+	ring->cqtail = (unsigned*)((char*)ring->cqmap + p.cq_off.tail);
+	ring->cqmask = *(unsigned*)((char*)ring->cqmap + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)((char*)ring->cqmap + p.cq_off.cqes);
+	ring->inflight = 0;
+	return 0;
+
+out_cq:
+	if (ring->cqmap != ring->sqmap)
+		munmap(ring->cqmap, ring->cqmapsize);
+out_sq:
+	munmap(ring->sqmap, ring->sqmapsize);
+out_fd:
+	close(ring->fd);
+	return -1;
+}
+
+static void ring_free(ring_t *ring)
+{
+	munmap(ring->sqes, ring->sqessize);
+	if (ring->cqmap != ring->sqmap)
+		munmap(ring->cqmap, ring->cqmapsize);
+	munmap(ring->sqmap, ring->sqmapsize);
+	close(ring->fd);
+}
+
+// Reads and writes arrived after io_uring itself (5.6), check for them.
+static int ring_supported(ring_t *ring)
+{
+	struct io_uring_probe *probe;
+	size_t size = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+	int ok = 0;
+
+	probe = (struct io_uring_probe*)calloc(1, size);
+	if (!probe)
+		return 0;
+	if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE,
+	            probe, 256) == 0)
+		ok = probe->ops_len > IORING_OP_WRITE &&
+		     probe->ops_len > IORING_OP_READ &&
+		     (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED) &&
+		     (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+	free(probe);
+	return ok;
+}
+
+static int ring_open(struct smackasync *a)
+{
+	if (ring_setup(&a->ring, a->depth * 2) != 0)
+		return -1;
+	if (!ring_supported(&a->ring) ||
+	    syscall(__NR_io_uring_register, a->ring.fd, IORING_REGISTER_EVENTFD,
+	            &a->evfd, 1) != 0)
+	{
+		ring_free(&a->ring);
+		return -1;
+	}
+	return 0;
+}
+
+// Hand the queued entries to the kernel, optionally waiting for one.
+static int ring_enter(ring_t *ring, int wait)
+{
+	unsigned queued = __atomic_load_n(ring->sqtail, __ATOMIC_RELAXED) -
+	                  __atomic_load_n(ring->sqhead, __ATOMIC_ACQUIRE);
+
+	if (!queued && !wait)
+		return 0;
+	if (syscall(__NR_io_uring_enter, ring->fd, queued, wait ? 1 : 0,
+	            wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0) < 0)
+	{
+		// entries which were not taken stay queued for the next call
+		if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+			return 0;
+		return -1;
+	}
+	return 0;
+}
+
+static void ring_prep(ring_t *ring, unsigned tail, int opcode, int fd,
+                      void *buf, size_t len, uint64_t data, int flags)
+{
+	unsigned idx = tail & ring->sqmask;
+	struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = (uint8_t)opcode;
+	sqe->flags = (uint8_t)flags;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = (uint32_t)len;
+	sqe->off = 0;
+	sqe->user_data = data;
+	ring->sqarray[idx] = idx;
+}
+
+/* The kernel only allows one write per open, so every request gets a
+ * fresh access file, which it writes and reads back in a linked pair.
+ */
+static int ring_submit(struct smackasync *a, asyncreq_t *r)
+{
+	ring_t *ring = &a->ring;
+	unsigned tail;
+
+	r->fd = openat(a->dirfd, a->longiface ? SMACK_ACCESS2 + sizeof(SMACK_FS)
+	                                      : SMACK_ACCESS + sizeof(SMACK_FS),
+	               O_RDWR | O_CLOEXEC);
+	if (r->fd < 0) {
+		if (errno == ENOENT)
+			errno = ENOSYS;
+		return -1;
+	}
+
+	tail = __atomic_load_n(ring->sqtail, __ATOMIC_RELAXED);
+	if (tail + 2 - __atomic_load_n(ring->sqhead, __ATOMIC_ACQUIRE) >
+	    ring->sqentries)
+	{
+		// cannot happen while every request has its two entries
+		close(r->fd);
+		errno = EAGAIN;
+		return -1;
+	}
+	r->pending = 2;
+	ring_prep(ring, tail, IORING_OP_WRITE, r->fd, r->request, r->size,
+	          (uint64_t)(uintptr_t)r, IOSQE_IO_LINK);
+	ring_prep(ring, tail + 1, IORING_OP_READ, r->fd, r->reply,
+	          sizeof(r->reply), (uint64_t)(uintptr_t)r | ASYNC_READTAG, 0);
+	__atomic_store_n(ring->sqtail, tail + 2, __ATOMIC_RELEASE);
+	++ring->inflight;
+
+	ring_enter(ring, 0);
+	return 0;
+}
+
+static void ring_reap(struct smackasync *a)
+{
+	ring_t *ring = &a->ring;
+	unsigned head = __atomic_load_n(ring->cqhead, __ATOMIC_RELAXED);
+	unsigned tail = __atomic_load_n(ring->cqtail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail; ++head) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & ring->cqmask];
+		asyncreq_t *r = (asyncreq_t*)(uintptr_t)(cqe->user_data & ~(uint64_t)ASYNC_READTAG);
+
+		if (!(cqe->user_data & ASYNC_READTAG)) {
+			// like smack_transact(), a failed write is a bad request
+			if (cqe->res < 0 || (size_t)cqe->res != r->size)
+				r->error = EINVAL;
+		} else if (!r->error)
+			r->allowed = cqe->res >= 1 && r->reply[0] == '1';
+
+		if (--r->pending)
+			continue;
+		close(r->fd);
+		r->fd = -1;
+		--ring->inflight;
+		learn(r);
+		finish(a, r);
+	}
+	__atomic_store_n(ring->cqhead, head, __ATOMIC_RELEASE);
+}
+#endif
+
+static void *worker(void *data)
+{
+	struct smackasync *a = (struct smackasync*)data;
+	asyncreq_t *r;
+	int rc;
+
+	pthread_mutex_lock(&a->lock);
+	for (;;) {
+		while (!a->queue && !a->stop)
+			pthread_cond_wait(&a->wake, &a->lock);
+		// queued requests are still answered when closing
+		if (!(r = a->queue))
+			break;
+		if (!(a->queue = r->next))
+			a->queuetail = &a->queue;
+		pthread_mutex_unlock(&a->lock);
+
+		rc = smack_transact(a->dirfd,
+		                    a->longiface ? SMACK_ACCESS2 + sizeof(SMACK_FS)
+		                                 : SMACK_ACCESS + sizeof(SMACK_FS),
+		                    r->request, r->size);
+		r->allowed = rc > 0;
+		r->error = rc < 0 ? errno : 0;
+		learn(r);
+		finish(a, r);
+
+		pthread_mutex_lock(&a->lock);
+	}
+	pthread_mutex_unlock(&a->lock);
+	return NULL;
+}
+
+static int pool_open(struct smackasync *a)
+{
+	pthread_cond_init(&a->wake, NULL);
+	a->queue = NULL;
+	a->queuetail = &a->queue;
+	a->stop = 0;
+	for (a->nworkers = 0; a->nworkers < ASYNC_THREADS; ++a->nworkers)
+		if (pthread_create(&a->workers[a->nworkers], NULL, worker, a) != 0)
+			break;
+	if (!a->nworkers) {
+		pthread_cond_destroy(&a->wake);
+		errno = EAGAIN;
+		return -1;
+	}
+	return 0;
+}
+
+static void pool_close(struct smackasync *a)
+{
+	int i;
+
+	pthread_mutex_lock(&a->lock);
+	a->stop = 1;
+	pthread_cond_broadcast(&a->wake);
+	pthread_mutex_unlock(&a->lock);
+	for (i = 0; i < a->nworkers; ++i)
+		pthread_join(a->workers[i], NULL);
+	pthread_cond_destroy(&a->wake);
+}
+
+static void pool_submit(struct smackasync *a, asyncreq_t *r)
+{
+	pthread_mutex_lock(&a->lock);
+	r->next = NULL;
+	*a->queuetail = r;
+	a->queuetail = &r->next;
+	pthread_cond_signal(&a->wake);
+	pthread_mutex_unlock(&a->lock);
+}
+
+struct smackasync *smackasync_open(unsigned depth, int flags)
+{
+	struct smackasync *a;
+	unsigned i;
+	int eno;
+
+	if (!depth)
+		depth = ASYNC_DEFAULTDEPTH;
+	if (depth > ASYNC_MAXDEPTH) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	a = (struct smackasync*)calloc(1, sizeof(*a));
+	if (!a) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	a->depth = depth;
+	a->reqs = (asyncreq_t*)calloc(depth, sizeof(*a->reqs));
+	if (!a->reqs) {
+		free(a);
+		errno = ENOMEM;
+		return NULL;
+	}
+	for (i = 0; i < depth; ++i) {
+		a->reqs[i].fd = -1;
+		a->reqs[i].next = i + 1 < depth ? &a->reqs[i+1] : NULL;
+	}
+	a->free = a->reqs;
+	a->done = NULL;
+	a->donetail = &a->done;
+	pthread_mutex_init(&a->lock, NULL);
+
+	a->dirfd = open(SMACK_FS, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (a->dirfd < 0) {
+		eno = errno == ENOENT ? ENOSYS : errno;
+		goto out;
+	}
+	a->longiface = (smackinterfaces() & SMACK_IFACE_ACCESS2) != 0;
+
+	a->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (a->evfd < 0) {
+		eno = errno;
+		goto out_dir;
+	}
+
+#ifdef ASYNC_URING
+	if (!(flags & SMACK_ASYNC_THREADS) && ring_open(a) == 0) {
+		a->uring = 1;
+		return a;
+	}
+#else
+	(void)flags;
+#endif
+	if (pool_open(a) == 0)
+		return a;
+	eno = errno;
+
+	close(a->evfd);
+out_dir:
+	close(a->dirfd);
+out:
+	pthread_mutex_destroy(&a->lock);
+	free(a->reqs);
+	free(a);
+	errno = eno;
+	return NULL;
+}
+
+int smackasync_fd(struct smackasync *a)
+{
+	return a->evfd;
+}
+
+int smackasync_flags(struct smackasync *a)
+{
+#ifdef ASYNC_URING
+	if (a->uring)
+		return 0;
+#endif
+	return SMACK_ASYNC_THREADS;
+}
+
+int smackasync_submit(struct smackasync *a,
+                      const char *subject, const char *object,
+                      int may, void *cookie)
+{
+	char rwxat[SMACK_ACCESSLEN];
+	asyncreq_t *r;
+	size_t sublen = strlen(subject);
+	size_t objlen = strlen(object);
+	size_t limit = a->longiface ? SMACK_LONGLABEL-1 : SMACK_SIZE-1;
+	int rc;
+
+	if (sublen >= limit || objlen >= limit) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&a->lock);
+	if ((r = a->free))
+		a->free = r->next;
+	pthread_mutex_unlock(&a->lock);
+	if (!r) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	r->cookie = cookie;
+	r->may = may;
+	r->sublen = sublen;
+	r->objlen = objlen;
+	r->allowed = 0;
+	r->error = 0;
+	smack_setaccess(may, rwxat);
+	if (a->longiface) {
+		r->size = smack_request_long(r->request, subject, sublen,
+		                             object, objlen, rwxat);
+		r->objoff = sublen + 1;
+	} else {
+		r->size = smack_request_legacy(r->request, subject, sublen,
+		                               object, objlen, rwxat);
+		r->objoff = SMACK_SIZE;
+	}
+
+	// requests decided without the kernel complete right away
+	rc = smack_access_known(subject, sublen, object, objlen, may);
+	if (rc >= 0) {
+		r->allowed = rc;
+		finish(a, r);
+		return 0;
+	}
+
+#ifdef ASYNC_URING
+	if (a->uring) {
+		if (ring_submit(a, r) == 0)
+			return 0;
+		rc = errno;
+		pthread_mutex_lock(&a->lock);
+		r->next = a->free;
+		a->free = r;
+		pthread_mutex_unlock(&a->lock);
+		errno = rc;
+		return -1;
+	}
+#endif
+	pool_submit(a, r);
+	return 0;
+}
+
+size_t smackasync_complete(struct smackasync *a,
+                           struct smackasync_result *results, size_t max)
+{
+	uint64_t count;
+	asyncreq_t *r;
+	size_t n = 0;
+	int more;
+
+	// clear the readiness first, so nothing finishing meanwhile is missed
+	if (read(a->evfd, &count, sizeof(count)) < 0) {
+		// nothing was signalled
+	}
+
+#ifdef ASYNC_URING
+	if (a->uring) {
+		ring_enter(&a->ring, 0);
+		ring_reap(a);
+	}
+#endif
+
+	pthread_mutex_lock(&a->lock);
+	while (n < max && (r = a->done)) {
+		if (!(a->done = r->next))
+			a->donetail = &a->done;
+		results[n].cookie = r->cookie;
+		results[n].allowed = r->allowed;
+		results[n].error = r->error;
+		++n;
+		r->next = a->free;
+		a->free = r;
+	}
+	more = a->done != NULL;
+	pthread_mutex_unlock(&a->lock);
+
+	if (more)
+		signal_ready(a);
+	return n;
+}
+
+void smackasync_close(struct smackasync *a)
+{
+	unsigned i;
+
+	if (!a)
+		return;
+
+#ifdef ASYNC_URING
+	if (a->uring) {
+		// the kernel may still write into the requests
+		while (a->ring.inflight) {
+			if (ring_enter(&a->ring, 1) != 0)
+				break;
+			ring_reap(a);
+		}
+		ring_free(&a->ring);
+	} else
+#endif
+		pool_close(a);
+
+	for (i = 0; i < a->depth; ++i)
+		if (a->reqs[i].fd >= 0)
+			close(a->reqs[i].fd);
+	close(a->evfd);
+	close(a->dirfd);
+	pthread_mutex_destroy(&a->lock);
+	free(a->reqs);
+	free(a);
+}
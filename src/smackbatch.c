@@ -0,0 +1,110 @@
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "smackint.h"
+
+typedef struct batchkey_s {
+	uint32_t hash;
+	size_t   sublen;
+	size_t   objlen;
+} batchkey_t;
+
+static int samequery(const struct smackquery *a, const batchkey_t *ka,
+                     const struct smackquery *b, const batchkey_t *kb)
+{
+	return ka->hash == kb->hash &&
+	       a->may == b->may &&
+	       ka->sublen == kb->sublen &&
+	       ka->objlen == kb->objlen &&
+	       !memcmp(a->subject, b->subject, ka->sublen) &&
+	       !memcmp(a->object, b->object, ka->objlen);
+}
+
+int smacksession_batch(struct smacksession *session,
+                       const struct smackquery *q, size_t n,
+                       int *results)
+{
+	size_t i, j;
+	size_t tablesize;
+	size_t *table;     // index+1 of the first occurrence of a query
+	batchkey_t *keys;
+	int failed = 0;
+	char rwxat[SMACK_ACCESSLEN];
+
+	if (!n)
+		return 0;
+
+	tablesize = 16;
+	while (tablesize < n * 2)
+		tablesize *= 2;
+
+	// Without memory we just don't deduplicate.
+	keys = (batchkey_t*)malloc(sizeof(*keys) * n +
+	                           sizeof(*table) * tablesize);
+	table = keys ? (size_t*)(keys + n) : NULL;
+	if (table)
+		memset(table, 0, sizeof(*table) * tablesize);
+
+	for (i = 0; i < n; ++i) {
+		batchkey_t key;
+		uint32_t hobj;
+
+		key.hash = smack_hashlabel(q[i].subject, &key.sublen);
+		hobj = smack_hashlabel(q[i].object, &key.objlen);
+		key.hash = (key.hash * 31 + hobj) * 31 + (uint32_t)q[i].may;
+
+		if (table) {
+			for (j = key.hash & (tablesize-1); table[j];
+			     j = (j+1) & (tablesize-1))
+			{
+				size_t first = table[j] - 1;
+				if (samequery(&q[first], &keys[first], &q[i], &key))
+					break;
+			}
+			if (table[j]) {
+				results[i] = results[table[j] - 1];
+				if (results[i] < 0)
+					++failed;
+				continue;
+			}
+			keys[i] = key;
+			table[j] = i + 1;
+		}
+
+		smack_setaccess(q[i].may, rwxat);
+		results[i] = smack_session_checkn(session,
+		                                  q[i].subject, key.sublen,
+		                                  q[i].object, key.objlen,
+		                                  rwxat);
+		if (errno) {
+			results[i] = -errno;
+			++failed;
+		}
+	}
+
+	free(keys);
+	errno = 0;
+	return failed;
+}
+
+int smackaccess_batch(const struct smackquery *q, size_t n, int *results)
+{
+	struct smacksession *session;
+	int rc;
+	size_t i;
+
+	session = smacksession_open();
+	if (!session) {
+		int eno = errno;
+		for (i = 0; i < n; ++i)
+			results[i] = -eno;
+		errno = eno;
+		return -1;
+	}
+
+	rc = smacksession_batch(session, q, n, results);
+	smacksession_close(session);
+	return rc;
+}
@@ -0,0 +1,378 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "smackint.h"
+
+#define CACHE_DEFAULT_BUDGET  (256 * 1024)
+#define CACHE_MIN_BUDGET      (4 * 1024)
+#define CACHE_DEFAULT_INTERVAL 1000
+// the concurrent cache splits its budget into 64 shards
+#define CACHE_MIN_CONCURRENT  (64 * 1024)
+
+/* A cached pair.
+ * allow and deny are bitmaps indexed by request masks (0..31):
+ * bit m is set once the kernel answered request m for this pair.
+ */
+typedef struct entry_s {
+	struct entry_s *chain;
+	struct entry_s *newer;
+	struct entry_s *older;
+	uint32_t hash;
+	uint32_t allow;
+	uint32_t deny;
+	size_t   sublen;
+	size_t   objlen;
+	char     labels[]; // "subject\0object\0"
+} entry_t;
+
+int smack_cache_enabled;
+static int concurrent;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static entry_t **buckets;
+static size_t    bucketcount;
+static entry_t  *newest;
+static entry_t  *oldest;
+static size_t    budget;
+static size_t    used;
+static size_t    entries;
+static struct smackcachestats stats;
+
+static unsigned  interval = CACHE_DEFAULT_INTERVAL;
+static struct timespec lastcheck;
+static int       checked;
+static uint64_t  fingerprint;
+static int       havefingerprint;
+
+static size_t entrysize(const entry_t *e)
+{
+	return sizeof(*e) + e->sublen + 1 + e->objlen + 1;
+}
+
+static void unlink_lru(entry_t *e)
+{
+	if (e->newer)
+		e->newer->older = e->older;
+	else
+		newest = e->older;
+	if (e->older)
+		e->older->newer = e->newer;
+	else
+		oldest = e->newer;
+}
+
+static void link_lru(entry_t *e)
+{
+	e->newer = NULL;
+	e->older = newest;
+	if (newest)
+		newest->newer = e;
+	newest = e;
+	if (!oldest)
+		oldest = e;
+}
+
+static void drop(entry_t *e)
+{
+	entry_t **pp;
+
+	for (pp = &buckets[e->hash & (bucketcount-1)]; *pp != e; pp = &(*pp)->chain)
+		;
+	*pp = e->chain;
+	unlink_lru(e);
+	used -= entrysize(e);
+	--entries;
+	free(e);
+}
+
+static void flush(void)
+{
+	while (oldest)
+		drop(oldest);
+}
+
+int smack_cache_fingerprint(uint64_t *out)
+{
+	int fd;
+	ssize_t rc;
+	char buf[4096];
+	uint64_t h = 14695981039346656037ull;
+	ssize_t i;
+
+	if (smackinterfaces() & SMACK_IFACE_LOAD2)
+		fd = open(SMACK_LOAD2, O_RDONLY | O_CLOEXEC);
+	else
+		fd = open(SMACK_LOAD, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	while ((rc = read(fd, buf, sizeof(buf))) > 0) {
+		for (i = 0; i < rc; ++i) {
+			h ^= (unsigned char)buf[i];
+			h *= 1099511628211ull;
+		}
+	}
+	close(fd);
+	if (rc < 0)
+		return 0;
+	*out = h;
+	return 1;
+}
+
+// Called with the lock held.
+static void revalidate(void)
+{
+	struct timespec now;
+	uint64_t fp;
+	long elapsed;
+
+	if (!interval)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - lastcheck.tv_sec) * 1000 +
+	          (now.tv_nsec - lastcheck.tv_nsec) / 1000000;
+	if (checked && elapsed < (long)interval)
+		return;
+	lastcheck = now;
+	checked = 1;
+
+	if (!smack_cache_fingerprint(&fp)) {
+		havefingerprint = 0;
+		return;
+	}
+	if (havefingerprint && fp != fingerprint) {
+		flush();
+		++stats.invalidations;
+	}
+	fingerprint = fp;
+	havefingerprint = 1;
+}
+
+static entry_t *find(uint32_t hash,
+                     const char *subject, size_t sublen,
+                     const char *object, size_t objlen)
+{
+	entry_t *e;
+
+	for (e = buckets[hash & (bucketcount-1)]; e; e = e->chain) {
+		if (e->hash == hash &&
+		    e->sublen == sublen && e->objlen == objlen &&
+		    !memcmp(e->labels, subject, sublen) &&
+		    !memcmp(e->labels + sublen + 1, object, objlen))
+			return e;
+	}
+	return NULL;
+}
+
+int smack_cache_lookup(const char *subject, size_t sublen,
+                       const char *object, size_t objlen,
+                       int may)
+{
+	uint32_t hash;
+	entry_t *e;
+	int rc = -1;
+
+	if (__atomic_load_n(&concurrent, __ATOMIC_RELAXED))
+		return smack_rcucache_lookup(subject, sublen, object, objlen, may);
+
+	may &= 31;
+	hash = smack_cache_pairhash(subject, sublen, object, objlen);
+
+	pthread_mutex_lock(&lock);
+	if (!buckets)
+		goto out;
+	revalidate();
+	e = find(hash, subject, sublen, object, objlen);
+	if (e)
+		rc = smack_cache_decide(e->allow, e->deny, may);
+	if (rc < 0) {
+		++stats.misses;
+		goto out;
+	}
+	++stats.hits;
+	unlink_lru(e);
+	link_lru(e);
+out:
+	pthread_mutex_unlock(&lock);
+	return rc;
+}
+
+void smack_cache_store(const char *subject, size_t sublen,
+                       const char *object, size_t objlen,
+                       int may, int allowed)
+{
+	uint32_t hash;
+	entry_t *e;
+
+	if (__atomic_load_n(&concurrent, __ATOMIC_RELAXED)) {
+		smack_rcucache_store(subject, sublen, object, objlen, may, allowed);
+		return;
+	}
+
+	may &= 31;
+	hash = smack_cache_pairhash(subject, sublen, object, objlen);
+	if (sizeof(entry_t) + sublen + objlen + 2 > budget / 4)
+		return;
+
+	pthread_mutex_lock(&lock);
+	if (!buckets)
+		goto out;
+	e = find(hash, subject, sublen, object, objlen);
+	if (!e) {
+		size_t size = sizeof(*e) + sublen + 1 + objlen + 1;
+		while (oldest && used + size > budget) {
+			drop(oldest);
+			++stats.evictions;
+		}
+		e = (entry_t*)malloc(size);
+		if (!e)
+			goto out;
+		e->hash = hash;
+		e->allow = 0;
+		e->deny = 0;
+		e->sublen = sublen;
+		e->objlen = objlen;
+		memcpy(e->labels, subject, sublen);
+		e->labels[sublen] = 0;
+		memcpy(e->labels + sublen + 1, object, objlen);
+		e->labels[sublen + 1 + objlen] = 0;
+		e->chain = buckets[hash & (bucketcount-1)];
+		buckets[hash & (bucketcount-1)] = e;
+		used += size;
+		++entries;
+	} else
+		unlink_lru(e);
+	link_lru(e);
+	if (allowed)
+		e->allow |= 1u << may;
+	else
+		e->deny |= 1u << may;
+out:
+	pthread_mutex_unlock(&lock);
+}
+
+int smackcache_enable(size_t bytes)
+{
+	return smackcache_enable2(bytes, 0);
+}
+
+int smackcache_enable2(size_t bytes, int flags)
+{
+	entry_t **b;
+	size_t count;
+
+	if (!bytes)
+		bytes = CACHE_DEFAULT_BUDGET;
+	if (bytes < CACHE_MIN_BUDGET)
+		bytes = CACHE_MIN_BUDGET;
+	if ((flags & SMACK_CACHE_CONCURRENT) && bytes < CACHE_MIN_CONCURRENT)
+		bytes = CACHE_MIN_CONCURRENT;
+
+	// Roughly one bucket per expected entry, the table counts as well.
+	count = 16;
+	while (count * 2 * 128 <= bytes)
+		count *= 2;
+
+	if (flags & SMACK_CACHE_CONCURRENT) {
+		if (smack_rcucache_enable(bytes, count) != 0)
+			return -1;
+		pthread_mutex_lock(&lock);
+		if (buckets) {
+			flush();
+			free(buckets);
+			buckets = NULL;
+			bucketcount = 0;
+		}
+		__atomic_store_n(&concurrent, 1, __ATOMIC_RELAXED);
+		smack_cache_enabled = 1;
+		pthread_mutex_unlock(&lock);
+		return 0;
+	}
+
+	b = (entry_t**)calloc(count, sizeof(*b));
+	if (!b) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	pthread_mutex_lock(&lock);
+	if (__atomic_load_n(&concurrent, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&concurrent, 0, __ATOMIC_RELAXED);
+		smack_rcucache_disable();
+	}
+	if (buckets) {
+		flush();
+		free(buckets);
+	}
+	buckets = b;
+	bucketcount = count;
+	budget = bytes - count * sizeof(*b);
+	used = 0;
+	checked = 0;
+	havefingerprint = 0;
+	smack_cache_enabled = 1;
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+void smackcache_disable(void)
+{
+	pthread_mutex_lock(&lock);
+	smack_cache_enabled = 0;
+	if (__atomic_load_n(&concurrent, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&concurrent, 0, __ATOMIC_RELAXED);
+		smack_rcucache_disable();
+	}
+	if (buckets) {
+		flush();
+		free(buckets);
+		buckets = NULL;
+		bucketcount = 0;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void smackcache_setinterval(unsigned ms)
+{
+	smack_rcucache_setinterval(ms);
+	pthread_mutex_lock(&lock);
+	interval = ms;
+	checked = 0;
+	havefingerprint = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+void smackcache_invalidate(void)
+{
+	smack_rcucache_invalidate();
+	smack_shmcache_invalidate();
+	pthread_mutex_lock(&lock);
+	if (buckets) {
+		flush();
+		++stats.invalidations;
+	}
+	checked = 0;
+	havefingerprint = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+void smackcache_stats(struct smackcachestats *out)
+{
+	if (__atomic_load_n(&concurrent, __ATOMIC_RELAXED)) {
+		smack_rcucache_stats(out);
+		return;
+	}
+	pthread_mutex_lock(&lock);
+	*out = stats;
+	out->entries = entries;
+	out->memory = used + bucketcount * sizeof(*buckets);
+	pthread_mutex_unlock(&lock);
+}
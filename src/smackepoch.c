@@ -0,0 +1,155 @@
+#include <sys/types.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "smackint.h"
+
+/* Epoch based reclamation.
+ * Every thread which reads shared data without a lock has a record with
+ * the global epoch it saw when it entered its read section (shifted
+ * left, the low bit is set while inside). The global epoch only moves
+ * on once every reader inside a read section has seen the current one,
+ * so after two steps nobody can still hold data retired before them.
+ */
+typedef struct reader_s {
+	struct reader_s *next;
+	unsigned long    state;
+	int              inuse;
+} reader_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long   epoch = 1;
+static reader_t       *readers;
+static struct smack_epoch_node *limbo;
+
+static pthread_once_t  once = PTHREAD_ONCE_INIT;
+static pthread_key_t   key;
+static __thread reader_t *self;
+
+static void detach(void *data)
+{
+	reader_t *r = (reader_t*)data;
+
+	pthread_mutex_lock(&lock);
+	__atomic_store_n(&r->state, 0, __ATOMIC_RELEASE);
+	r->inuse = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+// Only the forking thread survives in the child.
+static void atfork_child(void)
+{
+	reader_t *r;
+
+	pthread_mutex_init(&lock, NULL);
+	for (r = readers; r; r = r->next) {
+		if (r == self)
+			continue;
+		r->state = 0;
+		r->inuse = 0;
+	}
+}
+
+static void init(void)
+{
+	pthread_key_create(&key, detach);
+	pthread_atfork(NULL, NULL, atfork_child);
+}
+
+static reader_t *attach(void)
+{
+	reader_t *r;
+
+	pthread_once(&once, init);
+	pthread_mutex_lock(&lock);
+	for (r = readers; r; r = r->next)
+		if (!r->inuse)
+			break;
+	if (!r) {
+		r = (reader_t*)calloc(1, sizeof(*r));
+		if (!r) {
+			pthread_mutex_unlock(&lock);
+			return NULL;
+		}
+		r->next = readers;
+		readers = r;
+	}
+	r->inuse = 1;
+	pthread_mutex_unlock(&lock);
+
+	pthread_setspecific(key, r);
+	self = r;
+	return r;
+}
+
+int smack_epoch_enter(void)
+{
+	reader_t *r = self;
+
+	if (!r && !(r = attach()))
+		return -1;
+	__atomic_store_n(&r->state,
+	                 (__atomic_load_n(&epoch, __ATOMIC_RELAXED) << 1) | 1,
+	                 __ATOMIC_RELAXED);
+	// the state must be visible before any shared data is read
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return 0;
+}
+
+void smack_epoch_leave(void)
+{
+	__atomic_store_n(&self->state, 0, __ATOMIC_RELEASE);
+}
+
+// Called with the lock held.
+static void advance(void)
+{
+	unsigned long e = epoch;
+	reader_t *r;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for (r = readers; r; r = r->next) {
+		unsigned long st = __atomic_load_n(&r->state, __ATOMIC_ACQUIRE);
+		if ((st & 1) && (st >> 1) != e)
+			return;
+	}
+	__atomic_store_n(&epoch, e + 1, __ATOMIC_RELEASE);
+}
+
+void smack_epoch_reclaim(void)
+{
+	struct smack_epoch_node **pp, *n;
+	struct smack_epoch_node *done = NULL;
+
+	if (!__atomic_load_n(&limbo, __ATOMIC_RELAXED))
+		return;
+
+	pthread_mutex_lock(&lock);
+	advance();
+	for (pp = &limbo; (n = *pp); ) {
+		if (n->epoch + 2 <= epoch) {
+			__atomic_store_n(pp, n->next, __ATOMIC_RELAXED);
+			n->next = done;
+			done = n;
+		} else
+			pp = &n->next;
+	}
+	pthread_mutex_unlock(&lock);
+
+	while ((n = done)) {
+		done = n->next;
+		n->release(n);
+	}
+}
+
+void smack_epoch_retire(struct smack_epoch_node *node,
+                        void (*release)(struct smack_epoch_node*))
+{
+	node->release = release;
+	pthread_mutex_lock(&lock);
+	node->epoch = epoch;
+	node->next = limbo;
+	__atomic_store_n(&limbo, node, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&lock);
+	smack_epoch_reclaim();
+}
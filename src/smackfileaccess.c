@@ -0,0 +1,122 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <linux/xattr.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "smackint.h"
+
+/* Labels of files, keyed by the inode and its ctime: setting the label
+ * updates the ctime, so a relabeled file does not match its old entry.
+ * The table is direct mapped, a colliding file replaces the entry.
+ */
+#define FILECACHE_SIZE 1024
+
+typedef struct fileentry_s {
+	dev_t           dev;
+	ino_t           ino;
+	struct timespec ctime;
+	smacklabel_id_t label;
+} fileentry_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static fileentry_t     files[FILECACHE_SIZE];
+
+static fileentry_t *slot(const struct stat *st)
+{
+	uint64_t h = (uint64_t)st->st_dev * 0x9e3779b97f4a7c15ull ^ (uint64_t)st->st_ino;
+	h ^= h >> 29;
+	h *= 0xbf58476d1ce4e5b9ull;
+	h ^= h >> 32;
+	return &files[h & (FILECACHE_SIZE-1)];
+}
+
+static smacklabel_id_t lookup(const struct stat *st)
+{
+	fileentry_t *e = slot(st);
+	smacklabel_id_t label = SMACK_LABEL_NONE;
+
+	pthread_mutex_lock(&lock);
+	if (e->label &&
+	    e->dev == st->st_dev && e->ino == st->st_ino &&
+	    e->ctime.tv_sec == st->st_ctim.tv_sec &&
+	    e->ctime.tv_nsec == st->st_ctim.tv_nsec)
+		label = e->label;
+	pthread_mutex_unlock(&lock);
+	return label;
+}
+
+static void store(const struct stat *st, smacklabel_id_t label)
+{
+	fileentry_t *e = slot(st);
+
+	pthread_mutex_lock(&lock);
+	e->dev = st->st_dev;
+	e->ino = st->st_ino;
+	e->ctime = st->st_ctim;
+	e->label = label;
+	pthread_mutex_unlock(&lock);
+}
+
+/* Intern the label read from the file. Files without a label get the
+ * default label, as the kernel does.
+ */
+static smacklabel_id_t intern(char *label, ssize_t rc)
+{
+	if (rc < 0) {
+		if (errno != ENODATA && errno != ENOTSUP)
+			return SMACK_LABEL_NONE;
+		return smack_intern(SMACK_DEFAULT);
+	}
+	label[rc] = 0;
+	return smack_intern(label);
+}
+
+static int check(const char *subject, smacklabel_id_t object, int may)
+{
+	return smackaccess_n(subject, strlen(subject),
+	                     smack_labelname(object), smack_labellen(object),
+	                     may);
+}
+
+int smackaccess_fd(const char *subject, int fd, int may)
+{
+	char label[SMACK_LONGLABEL];
+	struct stat st;
+	smacklabel_id_t object;
+
+	if (fstat(fd, &st) != 0)
+		return 0;
+
+	object = lookup(&st);
+	if (!object) {
+		object = intern(label, fgetxattr(fd, XATTR_NAME_SMACK, label,
+		                                 sizeof(label)-1));
+		if (!object)
+			return 0;
+		store(&st, object);
+	}
+	return check(subject, object, may);
+}
+
+int smackaccess_path(const char *subject, const char *path, int may)
+{
+	char label[SMACK_LONGLABEL];
+	struct stat st;
+	smacklabel_id_t object;
+
+	if (stat(path, &st) != 0)
+		return 0;
+
+	object = lookup(&st);
+	if (!object) {
+		object = intern(label, getxattr(path, XATTR_NAME_SMACK, label,
+		                                sizeof(label)-1));
+		if (!object)
+			return 0;
+		store(&st, object);
+	}
+	return check(subject, object, may);
+}
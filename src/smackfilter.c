@@ -0,0 +1,229 @@
+#define _GNU_SOURCE // O_PATH
+#include <sys/types.h>
+#include <sys/xattr.h>
+#include <linux/xattr.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "smackint.h"
+
+#define FILTER_MAXTHREADS 16
+
+typedef struct job_s {
+	const char *const *names;
+	smacklabel_id_t   *labels;
+	size_t             from;
+	size_t             to;
+	int                dirfd;
+} job_t;
+
+/* Read the labels of names[from..to) into labels[], SMACK_LABEL_NONE
+ * for entries which cannot be read. There is no getxattr() relative to
+ * a directory descriptor, so the descriptor is reached through /proc.
+ */
+static void *fetch(void *data)
+{
+	job_t *job = (job_t*)data;
+	char path[PATH_MAX];
+	char label[SMACK_LONGLABEL];
+	size_t i;
+	int prefix;
+	ssize_t rc;
+
+	prefix = snprintf(path, sizeof(path), "/proc/self/fd/%d/", job->dirfd);
+	for (i = job->from; i < job->to; ++i) {
+		size_t len = strlen(job->names[i]);
+
+		job->labels[i] = SMACK_LABEL_NONE;
+		if (prefix + len >= sizeof(path))
+			continue;
+		memcpy(path + prefix, job->names[i], len + 1);
+		rc = lgetxattr(path, XATTR_NAME_SMACK, label, sizeof(label)-1);
+		if (rc >= 0) {
+			label[rc] = 0;
+			job->labels[i] = smack_intern(label);
+		} else if (errno == ENODATA || errno == ENOTSUP)
+			job->labels[i] = smack_intern(SMACK_DEFAULT);
+	}
+	return NULL;
+}
+
+/* Check that the directory can be reached through /proc, which is not
+ * mounted in every chroot nor early during boot. Without it, every
+ * entry would look unreadable and be denied.
+ */
+static int reachable(int dirfd)
+{
+	char path[32];
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", dirfd);
+	if (access(path, F_OK) == 0)
+		return 0;
+	errno = fcntl(dirfd, F_GETFD) < 0 ? EBADF : ENOSYS;
+	return -1;
+}
+
+static void fetchall(int dirfd, const char *const *names, size_t n,
+                    smacklabel_id_t *labels, int threads)
+{
+	pthread_t tids[FILTER_MAXTHREADS];
+	job_t jobs[FILTER_MAXTHREADS];
+	size_t per;
+	int t, started;
+
+	if (threads > FILTER_MAXTHREADS)
+		threads = FILTER_MAXTHREADS;
+	// not worth a thread for a few entries
+	if (threads < 1 || n < 256)
+		threads = 1;
+	per = (n + threads - 1) / threads;
+
+	for (t = 0; t < threads; ++t) {
+		jobs[t].names = names;
+		jobs[t].labels = labels;
+		jobs[t].dirfd = dirfd;
+		jobs[t].from = t * per < n ? t * per : n;
+		jobs[t].to = (t + 1) * per < n ? (t + 1) * per : n;
+	}
+
+	// the calling thread takes the first share
+	for (started = 1; started < threads; ++started)
+		if (pthread_create(&tids[started], NULL, fetch, &jobs[started]) != 0)
+			break;
+	fetch(&jobs[0]);
+	for (t = 1; t < started; ++t)
+		pthread_join(tids[t], NULL);
+	// shares which did not get a thread
+	for (t = started; t < threads; ++t)
+		fetch(&jobs[t]);
+}
+
+/* The decisions made so far, by object label: an open addressing table
+ * of label IDs with the decision stored beside them.
+ */
+typedef struct decisions_s {
+	smacklabel_id_t *ids;
+	unsigned char   *allowed;
+	size_t           size;
+	size_t           used;
+} decisions_t;
+
+static int decisions_grow(decisions_t *d)
+{
+	decisions_t n;
+	size_t i, j;
+
+	n.size = d->size ? d->size * 2 : 64;
+	n.used = d->used;
+	n.ids = (smacklabel_id_t*)calloc(n.size, sizeof(*n.ids));
+	n.allowed = (unsigned char*)malloc(n.size);
+	if (!n.ids || !n.allowed) {
+		free(n.ids);
+		free(n.allowed);
+		errno = ENOMEM;
+		return -1;
+	}
+	for (i = 0; i < d->size; ++i) {
+		if (!d->ids[i])
+			continue;
+		for (j = d->ids[i] & (n.size-1); n.ids[j]; j = (j+1) & (n.size-1))
+			;
+		n.ids[j] = d->ids[i];
+		n.allowed[j] = d->allowed[i];
+	}
+	free(d->ids);
+	free(d->allowed);
+	*d = n;
+	return 0;
+}
+
+/* Look up the decision for an object, deciding it if it is new.
+ * Returns 1 or 0, or -1 on error.
+ */
+static int decide(decisions_t *d, const char *subject, size_t sublen,
+                  smacklabel_id_t object, int may)
+{
+	size_t i;
+	int rc;
+
+	if ((d->used + 1) * 2 > d->size && decisions_grow(d) != 0)
+		return -1;
+	for (i = object & (d->size-1); d->ids[i]; i = (i+1) & (d->size-1))
+		if (d->ids[i] == object)
+			return d->allowed[i];
+
+	rc = smackaccess_n(subject, sublen,
+	                   smack_labelname(object), smack_labellen(object), may);
+	if (errno)
+		return -1;
+	d->ids[i] = object;
+	d->allowed[i] = (unsigned char)rc;
+	++d->used;
+	return rc;
+}
+
+int smack_filter_paths_mt(const char *subject, int dirfd,
+                          const char *const names[], size_t n,
+                          int may, unsigned char *out_allowed,
+                          int threads)
+{
+	smacklabel_id_t *labels;
+	decisions_t d = { NULL, NULL, 0, 0 };
+	size_t sublen = strlen(subject);
+	size_t i;
+	int rc, count = 0, eno, cwd = -1;
+
+	// /proc/self/fd has no entry for AT_FDCWD
+	if (dirfd == AT_FDCWD) {
+		cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+		if (cwd < 0)
+			return -1;
+		dirfd = cwd;
+	}
+	labels = (smacklabel_id_t*)malloc(sizeof(*labels) * (n ? n : 1));
+	if (!labels || reachable(dirfd) != 0) {
+		eno = labels ? errno : ENOMEM;
+		free(labels);
+		if (cwd >= 0)
+			close(cwd);
+		errno = eno;
+		return -1;
+	}
+	fetchall(dirfd, names, n, labels, threads);
+	if (cwd >= 0)
+		close(cwd);
+
+	for (i = 0; i < n; ++i) {
+		out_allowed[i] = 0;
+		if (!labels[i])
+			continue;
+		rc = decide(&d, subject, sublen, labels[i], may);
+		if (rc < 0) {
+			count = -1;
+			break;
+		}
+		out_allowed[i] = (unsigned char)rc;
+		count += rc;
+	}
+
+	eno = errno;
+	free(labels);
+	free(d.ids);
+	free(d.allowed);
+	errno = count < 0 ? eno : 0;
+	return count;
+}
+
+int smack_filter_paths(const char *subject, int dirfd,
+                       const char *const names[], size_t n,
+                       int may, unsigned char *out_allowed)
+{
+	return smack_filter_paths_mt(subject, dirfd, names, n, may,
+	                             out_allowed, 1);
+}
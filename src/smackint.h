@@ -0,0 +1,423 @@
+#ifndef SMACKINT_H_
+#define SMACKINT_H_
+
+/* Library internal helpers, this header is not installed. */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "smack.h"
+
+/* The size of a long access request: "subject object rwxat" */
+#define SMACK_REQUESTSIZE (SMACK_LONGLABEL + SMACK_LONGLABEL + SMACK_ACCESSLEN)
+
+/**
+ * Convert a textual access string into the 5 character "rwxat" form.
+ * Returns -1 if the string contains invalid characters.
+ */
+int smack_parseaccess(const char *access, char *out);
+
+/**
+ * Convert an SMACK_MAY_* bitmask into the 5 character "rwxat" form.
+ */
+void smack_setaccess(int may, char *out);
+
+/**
+ * Build a long access request "subject object rwxat" for the access2
+ * interface in buf, which must hold SMACK_REQUESTSIZE bytes.
+ * Returns the size of the request.
+ */
+size_t smack_request_long(char *buf,
+                          const char *subject, size_t sublen,
+                          const char *object, size_t objlen,
+                          const char *rwxat);
+
+/**
+ * Build a fixed size access request with 24 byte labels in buf.
+ * Returns the size of the request.
+ */
+size_t smack_request_legacy(char *buf,
+                            const char *subject, size_t sublen,
+                            const char *object, size_t objlen,
+                            const char *rwxat);
+
+/**
+ * Send a request to the access file at path, relative to dirfd.
+ * Returns 1 or 0 for the answer, -1 on error with errno set.
+ */
+int smack_transact(int dirfd, const char *path,
+                   const char *request, size_t size);
+
+/**
+ * Decide a request without asking the kernel, from the builtin rules
+ * or the decision caches.
+ * Returns 1 or 0 with errno cleared, or -1 if the kernel has to be asked.
+ */
+int smack_access_known(const char *subject, size_t sublen,
+                       const char *object, size_t objlen,
+                       int may);
+
+/**
+ * Remember a decision the kernel made in the enabled caches.
+ */
+void smack_access_learn(const char *subject, size_t sublen,
+                        const char *object, size_t objlen,
+                        int may, int allowed);
+
+/**
+ * Convert the 5 character "rwxat" form into an SMACK_MAY_* bitmask.
+ */
+static inline int smack_accessmask(const char *rwxat)
+{
+	return (rwxat[0] != '-' ? SMACK_MAY_R : 0) |
+	       (rwxat[1] != '-' ? SMACK_MAY_W : 0) |
+	       (rwxat[2] != '-' ? SMACK_MAY_X : 0) |
+	       (rwxat[3] != '-' ? SMACK_MAY_A : 0) |
+	       (rwxat[4] != '-' ? SMACK_MAY_T : 0);
+}
+
+/**
+ * FNV-1a hash of a label with a known length.
+ */
+static inline uint32_t smack_hashn(const char *label, size_t len)
+{
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		h ^= (unsigned char)label[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/**
+ * FNV-1a hash of a label, which also yields the label's length,
+ * so callers only need to walk the string once.
+ */
+static inline uint32_t smack_hashlabel(const char *label, size_t *len)
+{
+	uint32_t h = 2166136261u;
+	const char *p;
+
+	for (p = label; *p; ++p) {
+		h ^= (unsigned char)*p;
+		h *= 16777619u;
+	}
+	*len = (size_t)(p - label);
+	return h;
+}
+
+/**
+ * Perform an access check on a session with known label lengths.
+ * rwxat must point to the 5 character access form.
+ */
+int smack_session_checkn(struct smacksession *session,
+                         const char *subject, size_t sublen,
+                         const char *object, size_t objlen,
+                         const char *rwxat);
+
+/**
+ * Whether the kernel accepts a label: 1 to 255 printable characters
+ * other than '/', '"', '\\' and '\'', not starting with '-'.
+ */
+static inline int smack_validlabel(const char *label, size_t len)
+{
+	size_t i;
+
+	if (!len || len >= SMACK_LONGLABEL || label[0] == '-')
+		return 0;
+	for (i = 0; i < len; ++i)
+		if (label[i] <= ' ' || label[i] > '~' || label[i] == '/' ||
+		    label[i] == '"' || label[i] == '\\' || label[i] == '\'')
+			return 0;
+	return 1;
+}
+
+/**
+ * Smack's builtin rules, which apply before the rule list is consulted:
+ * A "*" subject gets no access, equal labels and a "*" object allow any
+ * access, and a "_" object or a "^" subject allow read and execute.
+ * Returns 1 or 0 if they decide the request, -1 if the rule list has
+ * to be consulted, or if a label is invalid and the kernel is to
+ * report the error.
+ */
+static inline int smack_builtin(const char *subject, size_t sublen,
+                                const char *object, size_t objlen,
+                                int may)
+{
+	if (!smack_validlabel(subject, sublen) ||
+	    !smack_validlabel(object, objlen))
+		return -1;
+	if (sublen == 1 && subject[0] == SMACK_STAR[0])
+		return 0;
+	if (sublen == objlen && !memcmp(subject, object, sublen))
+		return 1;
+	if (objlen == 1 && object[0] == SMACK_STAR[0])
+		return 1;
+	if ((may & ~(SMACK_MAY_R | SMACK_MAY_X)) == 0) {
+		if (objlen == 1 && object[0] == SMACK_FLOOR[0])
+			return 1;
+		if (sublen == 1 && subject[0] == SMACK_HAT[0])
+			return 1;
+	}
+	return -1;
+}
+
+/* The rules are kept as a CSR matrix: the rules of subject s are at
+ * objects[rowstart[s]] to objects[rowstart[s+1]-1], sorted by object
+ * ID, with their access in masks[].
+ */
+struct smackpolicy {
+	smacklabel_id_t  star;
+	smacklabel_id_t  floor;
+	smacklabel_id_t  hat;
+	smacklabel_id_t  web;
+	smacklabel_id_t  rows;
+	uint32_t        *rowstart;
+	smacklabel_id_t *objects;
+	unsigned char   *masks;
+	// the same rules by object, for reverse queries
+	smacklabel_id_t  cols;
+	uint32_t        *colstart;
+	smacklabel_id_t *subjects;
+	unsigned char   *colmasks;
+	size_t           rulecount;
+	int              verify;
+	unsigned long    mismatches;
+};
+
+/* Set while the decision cache is enabled, checked without locking. */
+extern int smack_cache_enabled;
+
+/**
+ * Look up a cached decision.
+ * Returns 1 or 0 for a cached decision, -1 if it is not cached.
+ */
+int smack_cache_lookup(const char *subject, size_t sublen,
+                       const char *object, size_t objlen,
+                       int may);
+
+/**
+ * Store a decision the kernel made.
+ */
+void smack_cache_store(const char *subject, size_t sublen,
+                       const char *object, size_t objlen,
+                       int may, int allowed);
+
+/**
+ * Hash the current rule list, so the caches notice when the policy
+ * changed. Returns 0 if the rule list cannot be read.
+ */
+int smack_cache_fingerprint(uint64_t *out);
+
+static inline uint32_t smack_cache_pairhash(const char *subject, size_t sublen,
+                                            const char *object, size_t objlen)
+{
+	return smack_hashn(subject, sublen) * 31 + smack_hashn(object, objlen);
+}
+
+/**
+ * Decide a request from the requests answered for a pair so far.
+ * allow and deny are bitmaps indexed by request masks (0..31).
+ * Allowed requests are closed under subsets and denied ones under
+ * supersets, so one answer also decides related requests.
+ * Returns 1 or 0, or -1 if the answers do not decide the request.
+ */
+static inline int smack_cache_decide(uint32_t allow, uint32_t deny, int may)
+{
+	uint32_t m;
+
+	if (allow & (1u << may))
+		return 1;
+	if (deny & (1u << may))
+		return 0;
+	for (m = 0; m < 32; ++m) {
+		if ((allow & (1u << m)) && (may & ~m) == 0)
+			return 1;
+		if ((deny & (1u << m)) && (m & ~may) == 0)
+			return 0;
+	}
+	return -1;
+}
+
+/* The concurrent cache of smackcache_enable2(), see smackrcucache.c. */
+int  smack_rcucache_enable(size_t bytes, size_t bucketcount);
+void smack_rcucache_disable(void);
+void smack_rcucache_setinterval(unsigned ms);
+void smack_rcucache_invalidate(void);
+void smack_rcucache_stats(struct smackcachestats *stats);
+int  smack_rcucache_lookup(const char *subject, size_t sublen,
+                           const char *object, size_t objlen,
+                           int may);
+void smack_rcucache_store(const char *subject, size_t sublen,
+                          const char *object, size_t objlen,
+                          int may, int allowed);
+
+/* The shared cache of smackshmcache_attach(), see smackshmcache.c. */
+extern int smack_shmcache_attached;
+int  smack_shmcache_lookup(const char *subject, size_t sublen,
+                           const char *object, size_t objlen,
+                           int may);
+void smack_shmcache_store(const char *subject, size_t sublen,
+                          const char *object, size_t objlen,
+                          int may, int allowed);
+void smack_shmcache_invalidate(void);
+
+/* Epoch based reclamation of data read without locks, see smackepoch.c.
+ * Readers bracket their accesses with smack_epoch_enter() and
+ * smack_epoch_leave(), which must not nest. Writers unlink data and
+ * pass it to smack_epoch_retire(), which calls @release once no reader
+ * can still hold it.
+ */
+struct smack_epoch_node {
+	struct smack_epoch_node *next;
+	unsigned long            epoch;
+	void (*release)(struct smack_epoch_node*);
+};
+
+/**
+ * Returns 0 on success, -1 if the thread could not be registered, in
+ * which case smack_epoch_leave() must not be called.
+ */
+int  smack_epoch_enter(void);
+void smack_epoch_leave(void);
+void smack_epoch_retire(struct smack_epoch_node *node,
+                        void (*release)(struct smack_epoch_node*));
+/**
+ * Release retired data which is no longer visible to any reader.
+ */
+void smack_epoch_reclaim(void);
+
+/**
+ * Get the precomputed smack_hashlabel() value of an interned label.
+ */
+uint32_t smack_labelhash(smacklabel_id_t id);
+
+/* The pattern transition rules, those with a trailing '*' matching every
+ * label starting with what comes before it, compiled into a trie: the
+ * subject patterns are spelled out from the root node 0, and the node
+ * where one ends leads to the root of a trie of the object patterns of
+ * its rules. Children and siblings are always added behind their parent
+ * and older siblings, so every link leads to a higher index.
+ * This is also the layout in the compiled database.
+ */
+#define SMACK_TRIE_EXACT      1 // an object pattern without '*' ends here
+#define SMACK_TRIE_PREFIX     2 // an object pattern with '*' ends here
+#define SMACK_TRIE_DENYEXACT  4 // the same for deny rules
+#define SMACK_TRIE_DENYPREFIX 8
+
+/* The rules matching a transition, a deny rule wins. */
+#define SMACK_TRANS_ALLOW 1
+#define SMACK_TRANS_DENY  2
+
+struct smack_trienode {
+	uint32_t child;   // first child, 0 for none
+	uint32_t sibling; // next child of the same parent, 0 for none
+	uint32_t exact;   // object trie of the subjects ending here, or 0
+	uint32_t prefix;  // object trie of the subject patterns ending here
+	uint8_t  c;       // the character leading here
+	uint8_t  flags;   // SMACK_TRIE_* in object tries
+	uint16_t unused;
+};
+
+static inline uint32_t smack_triestep(const struct smack_trienode *trie,
+                                      uint32_t node, unsigned char c)
+{
+	for (node = trie[node].child; node; node = trie[node].sibling)
+		if (trie[node].c == c)
+			return node;
+	return 0;
+}
+
+/**
+ * Find the patterns of the object trie at @node matching @obj.
+ * Returns SMACK_TRANS_* bits.
+ */
+static inline int smack_trieobject(const struct smack_trienode *trie,
+                                   uint32_t node, const char *obj)
+{
+	int found = 0;
+
+	for (;; ++obj) {
+		if (trie[node].flags & SMACK_TRIE_PREFIX)
+			found |= SMACK_TRANS_ALLOW;
+		if (trie[node].flags & SMACK_TRIE_DENYPREFIX)
+			return SMACK_TRANS_DENY;
+		if (!*obj) {
+			if (trie[node].flags & SMACK_TRIE_EXACT)
+				found |= SMACK_TRANS_ALLOW;
+			if (trie[node].flags & SMACK_TRIE_DENYEXACT)
+				return SMACK_TRANS_DENY;
+			return found;
+		}
+		if (!(node = smack_triestep(trie, node, *obj)))
+			return found;
+	}
+}
+
+/**
+ * Find the pattern rules matching a transition, stopping at the first
+ * deny rule.
+ * Returns SMACK_TRANS_ALLOW, SMACK_TRANS_DENY or 0.
+ */
+static inline int smack_trieverdict(const struct smack_trienode *trie,
+                                    size_t nodes,
+                                    const char *sub, const char *obj)
+{
+	uint32_t node = 0;
+	int found = 0;
+
+	if (!nodes)
+		return 0;
+	for (;; ++sub) {
+		if (trie[node].prefix)
+			found |= smack_trieobject(trie, trie[node].prefix, obj);
+		if (!*sub && trie[node].exact)
+			found |= smack_trieobject(trie, trie[node].exact, obj);
+		if (found & SMACK_TRANS_DENY)
+			return SMACK_TRANS_DENY;
+		if (!*sub || !(node = smack_triestep(trie, node, *sub)))
+			return found;
+	}
+}
+
+/* A copy of the transition rules of a context, see smackreach.c. */
+struct smack_transrules {
+	smacklabel_id_t       *pairs; // subject and object of each allowed pair
+	size_t                 count;
+	smacklabel_id_t       *denies; // and of each denied pair
+	size_t                 ndenies;
+	struct smack_trienode *trie;  // the pattern rules
+	size_t                 nodes;
+	unsigned long          generation;
+};
+
+/**
+ * Get the context behind smackchecktrans(), or NULL if the configured
+ * paths are invalid.
+ */
+struct smacktrans_ctx *smack_trans_default(void);
+
+/**
+ * Bring the rules of a context up to date, and get their generation,
+ * which changes whenever they are replaced.
+ */
+unsigned long smack_trans_generation(struct smacktrans_ctx *ctx);
+
+/**
+ * Copy the current rules of a context.
+ * Returns 0, or -1 with errno set to ENOMEM.
+ */
+int smack_trans_rules(struct smacktrans_ctx *ctx, struct smack_transrules *rules);
+void smack_trans_freerules(struct smack_transrules *rules);
+
+/* The number of transition files parsed so far, for the tests. */
+extern unsigned long smack_trans_parses;
+
+/* The number of threads parsing transition files, 0 for one per CPU.
+ * For the benchmarks.
+ */
+extern unsigned smack_trans_threads;
+
+#endif /* !SMACKINT_H_ */
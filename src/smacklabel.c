@@ -0,0 +1,198 @@
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "smackint.h"
+
+/* Label records live in fixed size pages which never move, so that
+ * an ID can be resolved without taking the lock.
+ */
+#define PAGE_BITS  10
+#define PAGE_SIZE  (1u << PAGE_BITS)
+#define PAGE_COUNT 4096
+#define ARENA_SIZE 16384
+
+typedef struct record_s {
+	const char *name;
+	uint32_t    len;
+	uint32_t    hash;
+} record_t;
+
+typedef struct arena_s {
+	struct arena_s *next;
+	size_t used;
+	char   data[ARENA_SIZE];
+} arena_t;
+
+static pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+static record_t *pages[PAGE_COUNT];
+static uint32_t  count; // the last assigned ID, IDs start at 1
+static arena_t  *arena;
+
+// open addressing table of IDs
+static smacklabel_id_t *table;
+static size_t           tablesize;
+
+static record_t *record(smacklabel_id_t id)
+{
+	record_t *page;
+
+	if (!id || id > __atomic_load_n(&count, __ATOMIC_ACQUIRE))
+		return NULL;
+	page = __atomic_load_n(&pages[id >> PAGE_BITS], __ATOMIC_ACQUIRE);
+	return &page[id & (PAGE_SIZE-1)];
+}
+
+static const char *storename(const char *label, size_t len)
+{
+	char *name;
+
+	if (!arena || arena->used + len + 1 > sizeof(arena->data)) {
+		arena_t *a = (arena_t*)malloc(sizeof(*a));
+		if (!a)
+			return NULL;
+		a->next = arena;
+		a->used = 0;
+		arena = a;
+	}
+	name = arena->data + arena->used;
+	memcpy(name, label, len);
+	name[len] = 0;
+	arena->used += len + 1;
+	return name;
+}
+
+// Called with at least the read lock held.
+static smacklabel_id_t find(const char *label, size_t len, uint32_t hash,
+                            size_t *slot)
+{
+	size_t i;
+
+	if (!table)
+		return 0;
+	for (i = hash & (tablesize-1); table[i]; i = (i+1) & (tablesize-1)) {
+		const record_t *r = record(table[i]);
+		if (r->hash == hash && r->len == len &&
+		    !memcmp(r->name, label, len))
+			return table[i];
+	}
+	if (slot)
+		*slot = i;
+	return 0;
+}
+
+// Called with the write lock held.
+static int grow(void)
+{
+	smacklabel_id_t *newtable;
+	size_t newsize = tablesize ? tablesize * 2 : 256;
+	size_t i, j;
+
+	newtable = (smacklabel_id_t*)calloc(newsize, sizeof(*newtable));
+	if (!newtable)
+		return -1;
+	for (i = 0; i < tablesize; ++i) {
+		if (!table[i])
+			continue;
+		j = record(table[i])->hash & (newsize-1);
+		while (newtable[j])
+			j = (j+1) & (newsize-1);
+		newtable[j] = table[i];
+	}
+	free(table);
+	table = newtable;
+	tablesize = newsize;
+	return 0;
+}
+
+smacklabel_id_t smack_labellookup(const char *label)
+{
+	size_t len;
+	uint32_t hash;
+	smacklabel_id_t id;
+
+	hash = smack_hashlabel(label, &len);
+	pthread_rwlock_rdlock(&lock);
+	id = find(label, len, hash, NULL);
+	pthread_rwlock_unlock(&lock);
+	return id;
+}
+
+smacklabel_id_t smack_intern(const char *label)
+{
+	size_t len, slot;
+	uint32_t hash;
+	smacklabel_id_t id;
+	record_t *page;
+	record_t *r;
+
+	hash = smack_hashlabel(label, &len);
+	if (len >= SMACK_LONGLABEL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	pthread_rwlock_rdlock(&lock);
+	id = find(label, len, hash, NULL);
+	pthread_rwlock_unlock(&lock);
+	if (id)
+		return id;
+
+	pthread_rwlock_wrlock(&lock);
+	// someone else might have been faster
+	id = find(label, len, hash, &slot);
+	if (id)
+		goto out;
+
+	if ((count + 2) * 2 > tablesize) {
+		if (grow() != 0)
+			goto nomem;
+		find(label, len, hash, &slot);
+	}
+
+	id = count + 1;
+	if ((id >> PAGE_BITS) >= PAGE_COUNT)
+		goto nomem;
+	page = pages[id >> PAGE_BITS];
+	if (!page) {
+		page = (record_t*)calloc(PAGE_SIZE, sizeof(*page));
+		if (!page)
+			goto nomem;
+		__atomic_store_n(&pages[id >> PAGE_BITS], page, __ATOMIC_RELEASE);
+	}
+	r = &page[id & (PAGE_SIZE-1)];
+	r->name = storename(label, len);
+	if (!r->name)
+		goto nomem;
+	r->len = (uint32_t)len;
+	r->hash = hash;
+	table[slot] = id;
+	__atomic_store_n(&count, id, __ATOMIC_RELEASE);
+out:
+	pthread_rwlock_unlock(&lock);
+	return id;
+nomem:
+	pthread_rwlock_unlock(&lock);
+	errno = ENOMEM;
+	return 0;
+}
+
+const char *smack_labelname(smacklabel_id_t id)
+{
+	const record_t *r = record(id);
+	return r ? r->name : NULL;
+}
+
+size_t smack_labellen(smacklabel_id_t id)
+{
+	const record_t *r = record(id);
+	return r ? r->len : 0;
+}
+
+uint32_t smack_labelhash(smacklabel_id_t id)
+{
+	const record_t *r = record(id);
+	return r ? r->hash : 0;
+}
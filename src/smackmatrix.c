@@ -0,0 +1,265 @@
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "smackint.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#  define HAVE_AVX2_DISPATCH 1
+#endif
+
+/* Plane PLANE_ANY has a bit for every object a subject has a rule with
+ * any access for (or which it may access through the unconditional
+ * builtin rules, such as those of "*" and "@"), the other planes one
+ * for each SMACK_MAY_* bit.
+ * The read/execute exceptions for "_" objects and "^" subjects only
+ * apply to some requests, so they are added when a row is computed.
+ */
+#define PLANE_COUNT 6
+#define PLANE_ANY   5
+
+typedef void (*androws_t)(uint64_t *out, const uint64_t *const *rows,
+                          int nrows, size_t words);
+
+struct smackmatrix {
+	smacklabel_id_t labels;   // rows and columns are label IDs < labels
+	size_t          words;    // 64 bit words per row
+	smacklabel_id_t star;
+	smacklabel_id_t floor;
+	smacklabel_id_t hat;
+	smacklabel_id_t web;
+	androws_t       androws;
+	uint64_t       *planes[PLANE_COUNT];
+};
+
+#define SETBIT(row, id) ((row)[(id) >> 6] |= (uint64_t)1 << ((id) & 63))
+#define GETBIT(row, id) (((row)[(id) >> 6] >> ((id) & 63)) & 1)
+
+static void androws_scalar(uint64_t *out, const uint64_t *const *rows,
+                           int nrows, size_t words)
+{
+	size_t w;
+	int r;
+
+	for (w = 0; w < words; ++w) {
+		uint64_t v = rows[0][w];
+		for (r = 1; r < nrows; ++r)
+			v &= rows[r][w];
+		out[w] &= v;
+	}
+}
+
+#ifdef HAVE_AVX2_DISPATCH
+__attribute__((target("avx2")))
+static void androws_avx2(uint64_t *out, const uint64_t *const *rows,
+                         int nrows, size_t words)
+{
+	size_t w = 0;
+	int r;
+
+	for (; w + 4 <= words; w += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(out + w));
+		for (r = 0; r < nrows; ++r)
+			v = _mm256_and_si256(v,
+			        _mm256_loadu_si256((const __m256i*)(rows[r] + w)));
+		_mm256_storeu_si256((__m256i*)(out + w), v);
+	}
+	for (; w < words; ++w) {
+		uint64_t v = out[w];
+		for (r = 0; r < nrows; ++r)
+			v &= rows[r][w];
+		out[w] = v;
+	}
+}
+#endif
+
+static androws_t pickandrows(void)
+{
+#ifdef HAVE_AVX2_DISPATCH
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return androws_avx2;
+#endif
+	return androws_scalar;
+}
+
+struct smackmatrix *smackmatrix_build(const struct smackpolicy *pol)
+{
+	struct smackmatrix *m;
+	smacklabel_id_t s, o;
+	uint32_t i;
+	int p, b;
+
+	m = (struct smackmatrix*)calloc(1, sizeof(*m));
+	if (!m) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	m->star = pol->star;
+	m->floor = pol->floor;
+	m->hat = pol->hat;
+	m->web = pol->web;
+	m->androws = pickandrows();
+
+	// every label the policy knows of gets a row and a column
+	m->labels = pol->rows;
+	for (i = 0; i < pol->rulecount; ++i)
+		if (pol->objects[i] >= m->labels)
+			m->labels = pol->objects[i] + 1;
+	if (m->star >= m->labels) m->labels = m->star + 1;
+	if (m->floor >= m->labels) m->labels = m->floor + 1;
+	if (m->hat >= m->labels) m->labels = m->hat + 1;
+	if (m->web >= m->labels) m->labels = m->web + 1;
+	m->words = (m->labels + 63) / 64;
+
+	for (p = 0; p < PLANE_COUNT; ++p) {
+		m->planes[p] = (uint64_t*)calloc((size_t)m->labels * m->words,
+		                                 sizeof(uint64_t));
+		if (!m->planes[p]) {
+			smackmatrix_free(m);
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+
+	for (s = 0; s < m->labels; ++s) {
+		// a "*" subject gets nothing at all
+		if (s == m->star)
+			continue;
+		for (p = 0; p < PLANE_COUNT; ++p) {
+			uint64_t *row = m->planes[p] + (size_t)s * m->words;
+			SETBIT(row, s);
+			SETBIT(row, m->star);
+			SETBIT(row, m->web);
+			// "@" may access everything
+			if (s == m->web)
+				for (o = 1; o < m->labels; ++o)
+					SETBIT(row, o);
+		}
+		if (s >= pol->rows)
+			continue;
+		for (i = pol->rowstart[s]; i < pol->rowstart[s+1]; ++i) {
+			int may = pol->masks[i];
+			o = pol->objects[i];
+			if (!may)
+				continue;
+			SETBIT(m->planes[PLANE_ANY] + (size_t)s * m->words, o);
+			for (b = 0; b < PLANE_ANY; ++b)
+				if (may & (1 << b))
+					SETBIT(m->planes[b] + (size_t)s * m->words, o);
+		}
+	}
+	return m;
+}
+
+void smackmatrix_free(struct smackmatrix *m)
+{
+	int p;
+
+	if (!m)
+		return;
+	for (p = 0; p < PLANE_COUNT; ++p)
+		free(m->planes[p]);
+	free(m);
+}
+
+size_t smackmatrix_words(const struct smackmatrix *m)
+{
+	return m->words;
+}
+
+// Clear the bits of a row which are not label IDs: 0 and those >= labels.
+static void cliprow(const struct smackmatrix *m, uint64_t *row)
+{
+	if (m->labels & 63)
+		row[m->words - 1] &= ((uint64_t)1 << (m->labels & 63)) - 1;
+	row[0] &= ~(uint64_t)1;
+}
+
+void smackmatrix_filter(const struct smackmatrix *m,
+                        smacklabel_id_t subject, int may,
+                        const uint64_t *candidates, uint64_t *out)
+{
+	const uint64_t *rows[PLANE_COUNT];
+	int nrows = 0;
+	int b;
+	int anyread = (may & ~(SMACK_MAY_R | SMACK_MAY_X)) == 0;
+
+	if (candidates)
+		memcpy(out, candidates, m->words * sizeof(*out));
+	else
+		memset(out, 0xff, m->words * sizeof(*out));
+
+	if (subject == m->star) {
+		memset(out, 0, m->words * sizeof(*out));
+		return;
+	}
+	// "^" may read and execute everything
+	if (anyread && subject == m->hat) {
+		cliprow(m, out);
+		return;
+	}
+
+	if (subject >= m->labels) {
+		// no rules: only itself (which has no column), "*" and "@"
+		uint64_t keep = GETBIT(out, m->star);
+		uint64_t web = GETBIT(out, m->web);
+		uint64_t floor = anyread ? GETBIT(out, m->floor) : 0;
+		memset(out, 0, m->words * sizeof(*out));
+		if (keep)
+			SETBIT(out, m->star);
+		if (web)
+			SETBIT(out, m->web);
+		if (floor)
+			SETBIT(out, m->floor);
+		return;
+	}
+
+	rows[nrows++] = m->planes[PLANE_ANY] + (size_t)subject * m->words;
+	for (b = 0; b < PLANE_ANY; ++b)
+		if (may & (1 << b))
+			rows[nrows++] = m->planes[b] + (size_t)subject * m->words;
+
+	if (anyread && (candidates ? GETBIT(candidates, m->floor) : 1)) {
+		m->androws(out, rows, nrows, m->words);
+		SETBIT(out, m->floor);
+	} else
+		m->androws(out, rows, nrows, m->words);
+}
+
+void smackmatrix_row(const struct smackmatrix *m,
+                     smacklabel_id_t subject, int may, uint64_t *out)
+{
+	smackmatrix_filter(m, subject, may, NULL, out);
+}
+
+int smackmatrix_check(const struct smackmatrix *m,
+                      smacklabel_id_t subject, smacklabel_id_t object,
+                      int may)
+{
+	int b;
+	size_t off;
+
+	if (subject == m->star)
+		return 0;
+	if (subject == m->web || object == m->web)
+		return 1;
+	if (subject == object || object == m->star)
+		return 1;
+	if ((may & ~(SMACK_MAY_R | SMACK_MAY_X)) == 0 &&
+	    (object == m->floor || subject == m->hat))
+		return 1;
+	if (subject >= m->labels || object >= m->labels)
+		return 0;
+
+	off = (size_t)subject * m->words;
+	if (!GETBIT(m->planes[PLANE_ANY] + off, object))
+		return 0;
+	for (b = 0; b < PLANE_ANY; ++b)
+		if ((may & (1 << b)) && !GETBIT(m->planes[b] + off, object))
+			return 0;
+	return 1;
+}
@@ -20,9 +20,9 @@
 #include <string.h>
 #include <errno.h>
 
-#include "smack.h"
+#include "smackint.h"
 
-static void setaccess(int may, char *out)
+void smack_setaccess(int may, char *out)
 {
 	out[0] = (may & SMACK_MAY_R) ? 'r' : '-';
 	out[1] = (may & SMACK_MAY_W) ? 'w' : '-';
@@ -33,122 +33,56 @@ static void setaccess(int may, char *out)
 
 int smackmayaccess2(const char *subject, const char *object, int may)
 {
-	char *buffer;
-	char *accesspart;
-	size_t sublen, objlen, bufsize;
-	char reply[16];
-
-	int fd;
-
-	errno = 0;
-
-	sublen = strlen(subject);
-	if (sublen >= SMACK_LONGLABEL-1) {
-		errno = EINVAL;
-		return 0;
-	}
-	objlen = strlen(object);
-	if (objlen >= SMACK_LONGLABEL-1) {
-		errno = EINVAL;
-		return 0;
-	}
-
-	bufsize = sublen + 1 + objlen + 1 + 5;
-	buffer = (char*)malloc(bufsize);
-
-	strcpy(buffer, subject);
-	strcpy(buffer + sublen + 1, object);
-	accesspart = buffer + sublen + 1 + objlen + 1;
-	setaccess(may, accesspart);
-
-	fd = open(SMACK_ACCESS, O_RDWR);
-	if (fd < 0) {
-		int eno = errno;
-		free(buffer);
-		errno = eno;
-		if (errno == ENOENT)
-			errno = ENOSYS;
-		return 0;
-	}
-
-	if (bufsize != write(fd, buffer, bufsize)) {
-		free(buffer);
-		errno = EINVAL;
-		close(fd);
-		return 0;
-	}
-	free(buffer);
-
-	if (read(fd, &reply, sizeof(reply)) < 1) {
-		close(fd);
-		errno = 0;
-		return 0;
-	}
-	close(fd);
-
-	return (reply[0] == '1') ? 1 : 0;
+	return smackaccess2_n(subject, strlen(subject), object, strlen(object), may);
 }
 
 int smackmayaccess(const char *subject, const char *object, int may)
 {
-	int rc;
-	union {
-		struct {
-			char subject[SMACK_SIZE];
-			char object[SMACK_SIZE];
-			char access[SMACK_ACCESSLEN];
-		} data;
-		char result;
-	} data;
-
-	int fd;
-	int i;
-
-	rc = smackmayaccess2(subject, object, may);
-	if (!errno)
-		return rc;
-
-	errno = 0;
-
-	memset(&data, 0, sizeof(data));
-	for (i = 0; i < 5; ++i)
-		data.data.access[i] = '-';
+	return smackaccess_n(subject, strlen(subject), object, strlen(object), may);
+}
 
-	if (strlen(subject) >= SMACK_SIZE-1)
-	{
-		errno = EINVAL;
-		return 0;
-	}
+int smackaccess_id(smacklabel_id_t subject, smacklabel_id_t object, int may)
+{
+	const char *sub = smack_labelname(subject);
+	const char *obj = smack_labelname(object);
 
-	if (strlen(object) >= SMACK_SIZE-1)
-	{
+	if (!sub || !obj) {
 		errno = EINVAL;
 		return 0;
 	}
+	return smackaccess_n(sub, smack_labellen(subject),
+	                     obj, smack_labellen(object), may);
+}
 
-	strncpy(data.data.subject, subject, sizeof(data.data.subject));
-	strncpy(data.data.object, object, sizeof(data.data.object));
-	setaccess(may, data.data.access);
-
-	fd = open(SMACK_ACCESS, O_RDWR);
-	if (fd < 0) {
-		if (errno == ENOENT)
-			errno = ENOSYS;
-		return 0;
-	}
-
-	if (sizeof(data) != write(fd, &data, sizeof(data))) {
-		errno = EINVAL;
-		close(fd);
+/* Each bit is allowed on its own if the full request is, and nothing but
+ * the builtin read and execute access is allowed if not even the empty
+ * request is. Only mixed cases need one request per bit.
+ */
+int smackgetaccess(const char *subject, const char *object)
+{
+	size_t sublen = strlen(subject);
+	size_t objlen = strlen(object);
+	int mask = 0;
+	int bit, rc;
+
+	rc = smackaccess_n(subject, sublen, object, objlen, SMACK_MAY_ALL);
+	if (errno)
+		return -1;
+	if (rc)
+		return SMACK_MAY_ALL;
+
+	rc = smackaccess_n(subject, sublen, object, objlen, 0);
+	if (errno)
+		return -1;
+	if (!rc)
 		return 0;
-	}
 
-	if (read(fd, &data, sizeof(data)) < 1) {
-		close(fd);
-		errno = 0;
-		return 0;
+	for (bit = SMACK_MAY_R; bit & SMACK_MAY_ALL; bit <<= 1) {
+		rc = smackaccess_n(subject, sublen, object, objlen, bit);
+		if (errno)
+			return -1;
+		if (rc)
+			mask |= bit;
 	}
-	close(fd);
-
-	return (data.result == '1') ? 1 : 0;
+	return mask;
 }
@@ -0,0 +1,483 @@
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "smackint.h"
+
+#define isspace(x) ( (x) == ' ' || \
+                     (x) == '\t' || \
+                     (x) == '\r' || \
+                     (x) == '\f' || \
+                     (x) == '\n' || \
+                     (x) == '\v' )
+
+typedef struct triple_s {
+	smacklabel_id_t subject;
+	smacklabel_id_t object;
+	uint32_t        seq;
+	int             may;
+} triple_t;
+
+static char *token(char **pos)
+{
+	char *start;
+
+	while (isspace(**pos))
+		++*pos;
+	if (!**pos)
+		return NULL;
+	start = *pos;
+	while (**pos && !isspace(**pos))
+		++*pos;
+	if (**pos) {
+		**pos = 0;
+		++*pos;
+	}
+	return start;
+}
+
+/* Parse the access part of a rule. Rules read from the kernel may
+ * contain the lock and bringup bits, which are not checked here.
+ */
+static int parsemay(const char *access)
+{
+	int may = 0;
+
+	for (; *access; ++access) {
+		switch (*access) {
+		case '-': case 'l': case 'L': case 'b': case 'B':
+			break;
+		case 'r': case 'R': may |= SMACK_MAY_R; break;
+		case 'w': case 'W': may |= SMACK_MAY_W; break;
+		case 'x': case 'X': may |= SMACK_MAY_X; break;
+		case 'a': case 'A': may |= SMACK_MAY_A; break;
+		case 't': case 'T': may |= SMACK_MAY_T; break;
+		default:
+			return -1;
+		}
+	}
+	return may;
+}
+
+static int cmptriple(const void *a, const void *b)
+{
+	const triple_t *x = (const triple_t*)a;
+	const triple_t *y = (const triple_t*)b;
+
+	if (x->subject != y->subject)
+		return x->subject < y->subject ? -1 : 1;
+	if (x->object != y->object)
+		return x->object < y->object ? -1 : 1;
+	return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+/* Read "subject object access" lines, as found in /smack/load2 or in
+ * smackgenload's input. A later rule for the same pair replaces an
+ * earlier one, as it does when loading rules into the kernel.
+ */
+static triple_t *readrules(FILE *fp, const char *filename, size_t *count)
+{
+	char *line = NULL;
+	size_t n = 0;
+	size_t lineno = 0;
+	size_t used = 0, allocated = 0;
+	triple_t *rules = NULL;
+
+	while (getline(&line, &n, fp) != -1) {
+		char *pos = line;
+		char *sub, *obj, *acc;
+		int may;
+
+		++lineno;
+		sub = token(&pos);
+		if (!sub || *sub == '#')
+			continue;
+		obj = token(&pos);
+		acc = token(&pos);
+		if (!obj || !acc || token(&pos) || (may = parsemay(acc)) < 0) {
+			fprintf(stderr, "%s:%zu: invalid rule\n", filename, lineno);
+			continue;
+		}
+
+		if (used == allocated) {
+			triple_t *r;
+			allocated = allocated ? allocated * 2 : 256;
+			r = (triple_t*)realloc(rules, sizeof(*rules) * allocated);
+			if (!r) {
+				free(rules);
+				free(line);
+				errno = ENOMEM;
+				return NULL;
+			}
+			rules = r;
+		}
+		rules[used].subject = smack_intern(sub);
+		rules[used].object = smack_intern(obj);
+		if (!rules[used].subject || !rules[used].object) {
+			fprintf(stderr, "%s:%zu: invalid label\n", filename, lineno);
+			continue;
+		}
+		rules[used].seq = (uint32_t)used;
+		rules[used].may = may;
+		++used;
+	}
+	free(line);
+
+	*count = used;
+	if (!rules)
+		rules = (triple_t*)malloc(sizeof(*rules));
+	return rules;
+}
+
+/* Transpose the rows into one list of subjects per object. Walking the
+ * rows in order keeps each list sorted.
+ */
+static int buildcolumns(struct smackpolicy *pol)
+{
+	smacklabel_id_t s, o;
+	uint32_t *fill;
+	size_t i;
+
+	pol->cols = 0;
+	for (i = 0; i < pol->rulecount; ++i)
+		if (pol->objects[i] >= pol->cols)
+			pol->cols = pol->objects[i] + 1;
+
+	pol->colstart = (uint32_t*)calloc(pol->cols + 1, sizeof(*pol->colstart));
+	pol->subjects = (smacklabel_id_t*)malloc(sizeof(*pol->subjects) * (pol->rulecount + 1));
+	pol->colmasks = (unsigned char*)malloc(pol->rulecount + 1);
+	fill = (uint32_t*)malloc(sizeof(*fill) * (pol->cols + 1));
+	if (!pol->colstart || !pol->subjects || !pol->colmasks || !fill) {
+		free(fill);
+		return -1;
+	}
+
+	for (i = 0; i < pol->rulecount; ++i)
+		pol->colstart[pol->objects[i] + 1]++;
+	for (o = 0; o < pol->cols; ++o)
+		pol->colstart[o + 1] += pol->colstart[o];
+	memcpy(fill, pol->colstart, sizeof(*fill) * (pol->cols + 1));
+
+	for (s = 0; s < pol->rows; ++s) {
+		for (i = pol->rowstart[s]; i < pol->rowstart[s + 1]; ++i) {
+			uint32_t at = fill[pol->objects[i]]++;
+			pol->subjects[at] = s;
+			pol->colmasks[at] = pol->masks[i];
+		}
+	}
+	free(fill);
+	return 0;
+}
+
+static int build(struct smackpolicy *pol, triple_t *rules, size_t count)
+{
+	size_t i, out;
+	smacklabel_id_t s;
+
+	qsort(rules, count, sizeof(*rules), cmptriple);
+
+	// keep the last rule of each pair
+	for (i = 0, out = 0; i < count; ++i) {
+		if (i + 1 < count &&
+		    rules[i+1].subject == rules[i].subject &&
+		    rules[i+1].object == rules[i].object)
+			continue;
+		rules[out++] = rules[i];
+	}
+	count = out;
+
+	pol->rows = count ? rules[count-1].subject + 1 : 0;
+	pol->rowstart = (uint32_t*)calloc(pol->rows + 1, sizeof(*pol->rowstart));
+	pol->objects = (smacklabel_id_t*)malloc(sizeof(*pol->objects) * (count + 1));
+	pol->masks = (unsigned char*)malloc(count + 1);
+	if (!pol->rowstart || !pol->objects || !pol->masks)
+		return -1;
+
+	for (i = 0; i < count; ++i) {
+		pol->rowstart[rules[i].subject + 1]++;
+		pol->objects[i] = rules[i].object;
+		pol->masks[i] = (unsigned char)rules[i].may;
+	}
+	for (s = 0; s < pol->rows; ++s)
+		pol->rowstart[s + 1] += pol->rowstart[s];
+	pol->rulecount = count;
+	return buildcolumns(pol);
+}
+
+struct smackpolicy *smackpolicy_open(const char *path)
+{
+	struct smackpolicy *pol;
+	triple_t *rules;
+	size_t count;
+	FILE *fp;
+	int eno;
+
+	if (!path)
+		path = (smackinterfaces() & SMACK_IFACE_LOAD2) ? SMACK_LOAD2 : SMACK_LOAD;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return NULL;
+	rules = readrules(fp, path, &count);
+	fclose(fp);
+	if (!rules)
+		return NULL;
+
+	pol = (struct smackpolicy*)calloc(1, sizeof(*pol));
+	if (!pol || build(pol, rules, count) != 0) {
+		free(rules);
+		smackpolicy_close(pol);
+		errno = ENOMEM;
+		return NULL;
+	}
+	free(rules);
+
+	pol->star = smack_intern(SMACK_STAR);
+	pol->floor = smack_intern(SMACK_FLOOR);
+	pol->hat = smack_intern(SMACK_HAT);
+	pol->web = smack_intern(SMACK_WEB);
+	if (!pol->star || !pol->floor || !pol->hat || !pol->web) {
+		eno = errno;
+		smackpolicy_close(pol);
+		errno = eno;
+		return NULL;
+	}
+	return pol;
+}
+
+void smackpolicy_close(struct smackpolicy *pol)
+{
+	if (!pol)
+		return;
+	free(pol->rowstart);
+	free(pol->objects);
+	free(pol->masks);
+	free(pol->colstart);
+	free(pol->subjects);
+	free(pol->colmasks);
+	free(pol);
+}
+
+size_t smackpolicy_rulecount(const struct smackpolicy *pol)
+{
+	return pol->rulecount;
+}
+
+/* Collect the labels of a posting list whose rules grant all of @may.
+ * Rules without any access are skipped, as they grant nothing.
+ */
+static size_t collect(const smacklabel_id_t *labels, const unsigned char *masks,
+                      uint32_t from, uint32_t to, int may,
+                      smacklabel_id_t *out, size_t max)
+{
+	size_t found = 0;
+	uint32_t i;
+
+	for (i = from; i < to; ++i) {
+		if (!masks[i] || (may & ~masks[i]))
+			continue;
+		if (found < max)
+			out[found] = labels[i];
+		++found;
+	}
+	return found;
+}
+
+size_t smackpolicy_objects(const struct smackpolicy *pol,
+                           smacklabel_id_t subject, int may,
+                           smacklabel_id_t *out, size_t max)
+{
+	if (subject >= pol->rows)
+		return 0;
+	return collect(pol->objects, pol->masks,
+	               pol->rowstart[subject], pol->rowstart[subject + 1],
+	               may, out, max);
+}
+
+size_t smackpolicy_subjects(const struct smackpolicy *pol,
+                            smacklabel_id_t object, int may,
+                            smacklabel_id_t *out, size_t max)
+{
+	if (object >= pol->cols)
+		return 0;
+	return collect(pol->subjects, pol->colmasks,
+	               pol->colstart[object], pol->colstart[object + 1],
+	               may, out, max);
+}
+
+// The access a rule grants, or -1 if there is no rule for the pair.
+static int rulemay(const struct smackpolicy *pol,
+                   smacklabel_id_t subject, smacklabel_id_t object)
+{
+	uint32_t lo, hi;
+
+	if (subject >= pol->rows)
+		return -1;
+	lo = pol->rowstart[subject];
+	hi = pol->rowstart[subject + 1];
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (pol->objects[mid] == object)
+			return pol->masks[mid];
+		if (pol->objects[mid] < object)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return -1;
+}
+
+static int decide(const struct smackpolicy *pol,
+                  smacklabel_id_t subject, smacklabel_id_t object,
+                  int may)
+{
+	int rule;
+
+	if (subject == pol->star)
+		return 0;
+	// the internet label may access anything and be accessed by anyone
+	if (subject == pol->web || object == pol->web)
+		return 1;
+	if (subject == object || object == pol->star)
+		return 1;
+	if ((may & ~(SMACK_MAY_R | SMACK_MAY_X)) == 0 &&
+	    (object == pol->floor || subject == pol->hat))
+		return 1;
+
+	rule = rulemay(pol, subject, object);
+	// a rule without any access denies even an empty request
+	if (rule <= 0)
+		return 0;
+	return (may & ~rule) == 0;
+}
+
+static int getaccess(const struct smackpolicy *pol,
+                     smacklabel_id_t subject, smacklabel_id_t object)
+{
+	int rule;
+
+	if (subject == pol->star)
+		return 0;
+	if (subject == pol->web || object == pol->web ||
+	    subject == object || object == pol->star)
+		return SMACK_MAY_ALL;
+
+	rule = rulemay(pol, subject, object);
+	if (rule < 0)
+		rule = 0;
+	if (object == pol->floor || subject == pol->hat)
+		rule |= SMACK_MAY_R | SMACK_MAY_X;
+	return rule;
+}
+
+static int verify(struct smackpolicy *pol,
+                  const char *subject, size_t sublen,
+                  const char *object, size_t objlen,
+                  int may, int mine)
+{
+	int kernel = smackaccess_n(subject, sublen, object, objlen, may);
+
+	if (errno)
+		return mine;
+	if (kernel != mine) {
+		char rwxat[SMACK_ACCESSLEN + 1];
+		smack_setaccess(may, rwxat);
+		rwxat[SMACK_ACCESSLEN] = 0;
+		__atomic_add_fetch(&pol->mismatches, 1, __ATOMIC_RELAXED);
+		fprintf(stderr, "smackpolicy: mismatch for %.*s %.*s %s: "
+		        "policy says %d, kernel says %d\n",
+		        (int)sublen, subject, (int)objlen, object, rwxat,
+		        mine, kernel);
+	}
+	return kernel;
+}
+
+int smackpolicy_check_id(struct smackpolicy *pol,
+                         smacklabel_id_t subject, smacklabel_id_t object,
+                         int may)
+{
+	int rc = decide(pol, subject, object, may);
+
+	if (pol->verify && subject && object)
+		return verify(pol, smack_labelname(subject), smack_labellen(subject),
+		              smack_labelname(object), smack_labellen(object),
+		              may, rc);
+	return rc;
+}
+
+/* The rule for the internet label, which smack_builtin() leaves to the
+ * kernel. Only asked after smack_builtin(), which denies a "*" subject.
+ */
+static int isweb(const char *subject, size_t sublen,
+                 const char *object, size_t objlen)
+{
+	return (sublen == 1 && subject[0] == SMACK_WEB[0]) ||
+	       (objlen == 1 && object[0] == SMACK_WEB[0]);
+}
+
+int smackpolicy_check(struct smackpolicy *pol,
+                      const char *subject, const char *object, int may)
+{
+	size_t sublen, objlen;
+	smacklabel_id_t sub, obj;
+	int rc;
+
+	sublen = strlen(subject);
+	objlen = strlen(object);
+	rc = smack_builtin(subject, sublen, object, objlen, may);
+	if (rc < 0 && isweb(subject, sublen, object, objlen))
+		rc = 1;
+	if (rc < 0) {
+		// labels which were never interned have no rules
+		sub = smack_labellookup(subject);
+		obj = sub ? smack_labellookup(object) : 0;
+		rc = (sub && obj) ? decide(pol, sub, obj, may) : 0;
+	}
+
+	if (pol->verify)
+		return verify(pol, subject, sublen, object, objlen, may, rc);
+	return rc;
+}
+
+int smackpolicy_getaccess_id(const struct smackpolicy *pol,
+                             smacklabel_id_t subject, smacklabel_id_t object)
+{
+	return getaccess(pol, subject, object);
+}
+
+int smackpolicy_getaccess(const struct smackpolicy *pol,
+                          const char *subject, const char *object)
+{
+	smacklabel_id_t sub, obj;
+	size_t sublen, objlen;
+	int rc;
+
+	sublen = strlen(subject);
+	objlen = strlen(object);
+	rc = smack_builtin(subject, sublen, object, objlen, SMACK_MAY_ALL);
+	if (rc >= 0)
+		return rc ? SMACK_MAY_ALL : 0;
+	if (isweb(subject, sublen, object, objlen))
+		return SMACK_MAY_ALL;
+
+	// labels which were never interned have no rules
+	sub = smack_labellookup(subject);
+	obj = sub ? smack_labellookup(object) : 0;
+	if (sub && obj)
+		return getaccess(pol, sub, obj);
+	if (smack_builtin(subject, sublen, object, objlen, SMACK_MAY_R | SMACK_MAY_X) > 0)
+		return SMACK_MAY_R | SMACK_MAY_X;
+	return 0;
+}
+
+void smackpolicy_setverify(struct smackpolicy *pol, int enable)
+{
+	pol->verify = enable;
+}
+
+unsigned long smackpolicy_mismatches(const struct smackpolicy *pol)
+{
+	return __atomic_load_n(&pol->mismatches, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,37 @@
+#include <unistd.h>
+
+#include "smack.h"
+
+// 0 until smackfs was found
+static int interfaces;
+
+static int probe(void)
+{
+	int found = 0;
+
+	if (access(SMACK_LOAD, F_OK) == 0)
+		found |= SMACK_IFACE_MOUNTED;
+	if (access(SMACK_ACCESS2, F_OK) == 0)
+		found |= SMACK_IFACE_ACCESS2;
+	if (access(SMACK_LOAD2, F_OK) == 0)
+		found |= SMACK_IFACE_LOAD2;
+	if (access(SMACK_CIPSO2, F_OK) == 0)
+		found |= SMACK_IFACE_CIPSO2;
+	// The long interfaces came with long label support.
+	if (found & (SMACK_IFACE_ACCESS2 | SMACK_IFACE_LOAD2))
+		found |= SMACK_IFACE_LONGLABEL;
+	return found;
+}
+
+int smackinterfaces(void)
+{
+	int found = __atomic_load_n(&interfaces, __ATOMIC_ACQUIRE);
+
+	if (found)
+		return found;
+	found = probe();
+	// smackfs may still be mounted later, so only keep what was found
+	if (found & SMACK_IFACE_MOUNTED)
+		__atomic_store_n(&interfaces, found, __ATOMIC_RELEASE);
+	return found;
+}
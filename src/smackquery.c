@@ -0,0 +1,141 @@
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+
+#include "smack.h"
+
+static struct option lopts[] = {
+	{ "help",      no_argument,       NULL, 'h' },
+	{ "file",      required_argument, NULL, 'f' },
+	{ "access",    required_argument, NULL, 'a' },
+	{ "subject",   required_argument, NULL, 's' },
+	{ "object",    required_argument, NULL, 'o' },
+
+	{ NULL, 0, NULL, 0 }
+};
+
+static void usage(const char *arg0, FILE *target, int exitstatus)
+{
+	fprintf(target, "usage: %s [options] -s subject | -o object\n", arg0);
+	fprintf(target,
+	"options:\n"
+	"  -h, --help            show this help message\n"
+	"  -f, --file=rules      read rules from a file instead of the kernel\n"
+	"  -a, --access=rwxat    only list rules granting all of this access\n"
+	"  -s, --subject=label   list the objects label has access to\n"
+	"  -o, --object=label    list the subjects with access to label\n"
+	);
+	exit(exitstatus);
+}
+
+static const char *opt_file = NULL;
+static const char *opt_subject = NULL;
+static const char *opt_object = NULL;
+static int         opt_may = 0;
+
+static int parsemay(const char *access)
+{
+	int may = 0;
+
+	for (; *access; ++access) {
+		switch (*access) {
+			case '-':
+				break;
+			case 'r': case 'R': may |= SMACK_MAY_R; break;
+			case 'w': case 'W': may |= SMACK_MAY_W; break;
+			case 'x': case 'X': may |= SMACK_MAY_X; break;
+			case 'a': case 'A': may |= SMACK_MAY_A; break;
+			case 't': case 'T': may |= SMACK_MAY_T; break;
+			default:
+				return -1;
+		}
+	}
+	return may;
+}
+
+static void checkargs(int argc, char **argv)
+{
+	int o;
+	int lind = 0;
+
+	while ( (o = getopt_long(argc, argv, "+hf:a:s:o:", lopts, &lind)) != -1 ) {
+		switch (o)
+		{
+			case 'h':
+				usage(argv[0], stdout, 0);
+				break;
+			case 'f':
+				opt_file = optarg;
+				break;
+			case 'a':
+				opt_may = parsemay(optarg);
+				if (opt_may < 0) {
+					fprintf(stderr, "%s: invalid access: %s\n",
+					        argv[0], optarg);
+					exit(1);
+				}
+				break;
+			case 's':
+				opt_subject = optarg;
+				break;
+			case 'o':
+				opt_object = optarg;
+				break;
+			default:
+				usage(argv[0], stderr, 1);
+				break;
+		};
+	}
+
+	if (optind != argc || !opt_subject == !opt_object) {
+		fprintf(stderr, "%s: either a subject or an object is required\n",
+		        argv[0]);
+		usage(argv[0], stderr, 1);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct smackpolicy *policy;
+	smacklabel_id_t label;
+	smacklabel_id_t *ids = NULL;
+	size_t max = 0, count, i;
+
+	checkargs(argc, argv);
+
+	policy = smackpolicy_open(opt_file);
+	if (!policy) {
+		fprintf(stderr, "%s: failed to read rules from %s: %s\n", argv[0],
+		        opt_file ? opt_file : "the kernel", strerror(errno));
+		return 1;
+	}
+
+	// a label without any rules is not known to the policy
+	label = smack_labellookup(opt_subject ? opt_subject : opt_object);
+	count = 0;
+	while (label) {
+		if (opt_subject)
+			count = smackpolicy_objects(policy, label, opt_may, ids, max);
+		else
+			count = smackpolicy_subjects(policy, label, opt_may, ids, max);
+		if (count <= max)
+			break;
+		free(ids);
+		max = count;
+		ids = (smacklabel_id_t*)malloc(sizeof(*ids) * max);
+		if (!ids) {
+			fprintf(stderr, "%s: out of memory\n", argv[0]);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < count; ++i)
+		printf("%s\n", smack_labelname(ids[i]));
+
+	free(ids);
+	smackpolicy_close(policy);
+	return 0;
+}
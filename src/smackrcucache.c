@@ -0,0 +1,472 @@
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "smackint.h"
+
+/* The concurrent variant of the decision cache.
+ * Lookups take no lock: they find the current table through one atomic
+ * pointer and walk chains which are only ever prepended to. Inserts
+ * lock one of SHARDS shards, chosen by the low bits of the pair's hash.
+ * Entries are never unlinked one by one: a shard which runs out of
+ * budget detaches all of its chains at once, and when the policy
+ * changes, a fresh table replaces the whole table. Detached data is
+ * freed once no reader can see it any more.
+ */
+#define SHARD_BITS 6
+#define SHARDS     (1u << SHARD_BITS)
+
+typedef struct centry_s {
+	struct centry_s *chain;
+	uint32_t hash;
+	uint32_t allow; // set atomically
+	uint32_t deny;  // set atomically
+	uint32_t sublen;
+	uint32_t objlen;
+	char     labels[]; // "subject\0object\0"
+} centry_t;
+
+typedef struct shard_s {
+	pthread_mutex_t lock;
+	size_t          used;
+	size_t          entries;
+} __attribute__((aligned(64))) shard_t;
+
+typedef struct table_s {
+	struct smack_epoch_node node;
+	size_t    bucketcount;
+	size_t    shardbudget;
+	shard_t   shards[SHARDS];
+	centry_t *buckets[];
+} table_t;
+
+// the chains a shard dropped
+typedef struct batch_s {
+	struct smack_epoch_node node;
+	size_t    count;
+	centry_t *chains[];
+} batch_t;
+
+static pthread_mutex_t ctl = PTHREAD_MUTEX_INITIALIZER;
+static table_t        *current;
+
+/* Every thread counts its own hits and misses, so lookups never write
+ * to a line which other threads write too. The records stay on a list
+ * for the statistics; a thread which exits adds its counts to the
+ * globals and leaves its record to the next thread.
+ */
+typedef struct counter_s {
+	struct counter_s *next;
+	unsigned long     hits;   // only written by its thread
+	unsigned long     misses; // only written by its thread
+	int               inuse;
+} __attribute__((aligned(64))) counter_t;
+
+static counter_t      *counters; // protected by ctl
+static pthread_once_t  once = PTHREAD_ONCE_INIT;
+static pthread_key_t   key;
+static __thread counter_t *self;
+
+// hits and misses of threads which are gone, and the rest
+static unsigned long   hits;
+static unsigned long   misses;
+static unsigned long   evictions;
+static unsigned long   invalidations;
+
+static unsigned        interval = 1000;
+static long            lastcheck; // in ms
+static int             checked;
+static uint64_t        fingerprint;
+static int             havefingerprint;
+
+static void detach(void *data)
+{
+	counter_t *c = (counter_t*)data;
+
+	pthread_mutex_lock(&ctl);
+	__atomic_add_fetch(&hits, c->hits, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&misses, c->misses, __ATOMIC_RELAXED);
+	c->hits = 0;
+	c->misses = 0;
+	c->inuse = 0;
+	pthread_mutex_unlock(&ctl);
+}
+
+static void init(void)
+{
+	pthread_key_create(&key, detach);
+}
+
+static counter_t *attach(void)
+{
+	counter_t *c;
+	void *mem;
+
+	pthread_once(&once, init);
+	pthread_mutex_lock(&ctl);
+	for (c = counters; c; c = c->next)
+		if (!c->inuse)
+			break;
+	if (!c) {
+		if (posix_memalign(&mem, 64, sizeof(*c)) != 0) {
+			pthread_mutex_unlock(&ctl);
+			return NULL;
+		}
+		c = (counter_t*)mem;
+		memset(c, 0, sizeof(*c));
+		c->next = counters;
+		counters = c;
+	}
+	c->inuse = 1;
+	pthread_mutex_unlock(&ctl);
+
+	pthread_setspecific(key, c);
+	self = c;
+	return c;
+}
+
+/* Count a lookup. Without a record of its own, a thread falls back to
+ * the shared counters.
+ */
+static void count(int hit)
+{
+	counter_t *c = self;
+
+	if (!c && !(c = attach())) {
+		__atomic_add_fetch(hit ? &hits : &misses, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	if (hit)
+		__atomic_store_n(&c->hits, c->hits + 1, __ATOMIC_RELAXED);
+	else
+		__atomic_store_n(&c->misses, c->misses + 1, __ATOMIC_RELAXED);
+}
+
+static table_t *newtable(size_t bucketcount, size_t shardbudget)
+{
+	table_t *t;
+	void *mem;
+	size_t size = sizeof(*t) + bucketcount * sizeof(t->buckets[0]);
+	unsigned i;
+
+	if (posix_memalign(&mem, 64, size) != 0)
+		return NULL;
+	t = (table_t*)mem;
+	memset(t, 0, size);
+	t->bucketcount = bucketcount;
+	t->shardbudget = shardbudget;
+	for (i = 0; i < SHARDS; ++i)
+		pthread_mutex_init(&t->shards[i].lock, NULL);
+	return t;
+}
+
+static void freechain(centry_t *e)
+{
+	centry_t *next;
+
+	for (; e; e = next) {
+		next = e->chain;
+		free(e);
+	}
+}
+
+static void freetable(struct smack_epoch_node *node)
+{
+	table_t *t = (table_t*)node;
+	size_t i;
+
+	for (i = 0; i < t->bucketcount; ++i)
+		freechain(t->buckets[i]);
+	for (i = 0; i < SHARDS; ++i)
+		pthread_mutex_destroy(&t->shards[i].lock);
+	free(t);
+}
+
+static void freebatch(struct smack_epoch_node *node)
+{
+	batch_t *b = (batch_t*)node;
+	size_t i;
+
+	for (i = 0; i < b->count; ++i)
+		freechain(b->chains[i]);
+	free(b);
+}
+
+/* Drop all entries of a shard. Called with the shard's lock held.
+ * Returns -1 if there is no memory to do so.
+ */
+static int evict(table_t *t, shard_t *sh)
+{
+	size_t first = (size_t)(sh - t->shards);
+	size_t i, n = 0;
+	batch_t *b;
+
+	b = (batch_t*)malloc(sizeof(*b) + t->bucketcount / SHARDS * sizeof(b->chains[0]));
+	if (!b)
+		return -1;
+	for (i = first; i < t->bucketcount; i += SHARDS)
+		b->chains[n++] = __atomic_exchange_n(&t->buckets[i], NULL, __ATOMIC_ACQ_REL);
+	b->count = n;
+	__atomic_add_fetch(&evictions, sh->entries, __ATOMIC_RELAXED);
+	sh->entries = 0;
+	sh->used = 0;
+	smack_epoch_retire(&b->node, freebatch);
+	return 0;
+}
+
+static void retire(table_t *t)
+{
+	__atomic_add_fetch(&invalidations, 1, __ATOMIC_RELAXED);
+	smack_epoch_retire(&t->node, freetable);
+}
+
+/* Replace the table @old with an empty one of the same size.
+ * Nothing happens if someone else replaced it already.
+ */
+static void replace(table_t *old)
+{
+	table_t *t = newtable(old->bucketcount, old->shardbudget);
+
+	if (!t)
+		return;
+	if (!__atomic_compare_exchange_n(&current, &old, t, 0,
+	                                 __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		freetable(&t->node);
+		return;
+	}
+	retire(old);
+}
+
+static long now_ms(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* Only one thread fingerprints the policy, the others go on using the
+ * table in the meantime.
+ */
+static void revalidate(void)
+{
+	long now;
+	uint64_t fp;
+	table_t *t;
+
+	if (!__atomic_load_n(&interval, __ATOMIC_RELAXED))
+		return;
+	now = now_ms();
+	if (__atomic_load_n(&checked, __ATOMIC_ACQUIRE) &&
+	    now - __atomic_load_n(&lastcheck, __ATOMIC_RELAXED) < (long)interval)
+		return;
+	if (pthread_mutex_trylock(&ctl) != 0)
+		return;
+	if (checked && now - lastcheck < (long)interval)
+		goto out;
+	__atomic_store_n(&lastcheck, now, __ATOMIC_RELAXED);
+	__atomic_store_n(&checked, 1, __ATOMIC_RELEASE);
+
+	if (!smack_cache_fingerprint(&fp)) {
+		havefingerprint = 0;
+		goto out;
+	}
+	t = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+	if (havefingerprint && fp != fingerprint && t)
+		replace(t);
+	fingerprint = fp;
+	havefingerprint = 1;
+out:
+	pthread_mutex_unlock(&ctl);
+}
+
+static centry_t *find(table_t *t, uint32_t hash,
+                      const char *subject, size_t sublen,
+                      const char *object, size_t objlen)
+{
+	centry_t *e;
+
+	e = __atomic_load_n(&t->buckets[hash & (t->bucketcount-1)], __ATOMIC_ACQUIRE);
+	for (; e; e = e->chain) {
+		if (e->hash == hash &&
+		    e->sublen == sublen && e->objlen == objlen &&
+		    !memcmp(e->labels, subject, sublen) &&
+		    !memcmp(e->labels + sublen + 1, object, objlen))
+			return e;
+	}
+	return NULL;
+}
+
+int smack_rcucache_lookup(const char *subject, size_t sublen,
+                          const char *object, size_t objlen,
+                          int may)
+{
+	uint32_t hash;
+	table_t *t;
+	centry_t *e;
+	int rc = -1;
+
+	may &= 31;
+	hash = smack_cache_pairhash(subject, sublen, object, objlen);
+
+	revalidate();
+	if (smack_epoch_enter() != 0)
+		return -1;
+	t = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+	if (!t)
+		goto out;
+	e = find(t, hash, subject, sublen, object, objlen);
+	if (e)
+		rc = smack_cache_decide(__atomic_load_n(&e->allow, __ATOMIC_RELAXED),
+		                        __atomic_load_n(&e->deny, __ATOMIC_RELAXED),
+		                        may);
+	count(rc >= 0);
+out:
+	smack_epoch_leave();
+	return rc;
+}
+
+void smack_rcucache_store(const char *subject, size_t sublen,
+                          const char *object, size_t objlen,
+                          int may, int allowed)
+{
+	uint32_t hash;
+	table_t *t;
+	centry_t *e;
+	shard_t *sh;
+	size_t size = sizeof(*e) + sublen + 1 + objlen + 1;
+
+	may &= 31;
+	hash = smack_cache_pairhash(subject, sublen, object, objlen);
+
+	if (smack_epoch_enter() != 0)
+		return;
+	t = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+	if (!t || size > t->shardbudget / 4)
+		goto out;
+
+	e = find(t, hash, subject, sublen, object, objlen);
+	if (!e) {
+		centry_t **bucket = &t->buckets[hash & (t->bucketcount-1)];
+
+		sh = &t->shards[hash & (SHARDS-1)];
+		pthread_mutex_lock(&sh->lock);
+		e = find(t, hash, subject, sublen, object, objlen);
+		if (!e && sh->used + size > t->shardbudget && evict(t, sh) != 0)
+			goto unlock;
+		if (!e && (e = (centry_t*)malloc(size))) {
+			e->hash = hash;
+			e->allow = 0;
+			e->deny = 0;
+			e->sublen = (uint32_t)sublen;
+			e->objlen = (uint32_t)objlen;
+			memcpy(e->labels, subject, sublen);
+			e->labels[sublen] = 0;
+			memcpy(e->labels + sublen + 1, object, objlen);
+			e->labels[sublen + 1 + objlen] = 0;
+			e->chain = *bucket;
+			__atomic_store_n(bucket, e, __ATOMIC_RELEASE);
+			sh->used += size;
+			++sh->entries;
+		}
+unlock:
+		pthread_mutex_unlock(&sh->lock);
+	}
+	if (e)
+		__atomic_or_fetch(allowed ? &e->allow : &e->deny, 1u << may,
+		                  __ATOMIC_RELAXED);
+out:
+	smack_epoch_leave();
+	smack_epoch_reclaim();
+}
+
+int smack_rcucache_enable(size_t bytes, size_t bucketcount)
+{
+	table_t *t, *old;
+
+	if (bucketcount < SHARDS)
+		bucketcount = SHARDS;
+	t = newtable(bucketcount, (bytes - bucketcount * sizeof(t->buckets[0])) / SHARDS);
+	if (!t) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctl);
+	old = __atomic_exchange_n(&current, t, __ATOMIC_SEQ_CST);
+	checked = 0;
+	havefingerprint = 0;
+	pthread_mutex_unlock(&ctl);
+	if (old)
+		smack_epoch_retire(&old->node, freetable);
+	return 0;
+}
+
+void smack_rcucache_disable(void)
+{
+	table_t *old;
+
+	pthread_mutex_lock(&ctl);
+	old = __atomic_exchange_n(&current, NULL, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&ctl);
+	if (old)
+		smack_epoch_retire(&old->node, freetable);
+}
+
+void smack_rcucache_setinterval(unsigned ms)
+{
+	pthread_mutex_lock(&ctl);
+	__atomic_store_n(&interval, ms, __ATOMIC_RELAXED);
+	checked = 0;
+	havefingerprint = 0;
+	pthread_mutex_unlock(&ctl);
+}
+
+void smack_rcucache_invalidate(void)
+{
+	table_t *t;
+
+	pthread_mutex_lock(&ctl);
+	t = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+	if (t)
+		replace(t);
+	checked = 0;
+	havefingerprint = 0;
+	pthread_mutex_unlock(&ctl);
+}
+
+void smack_rcucache_stats(struct smackcachestats *out)
+{
+	table_t *t;
+	counter_t *c;
+	unsigned i;
+
+	memset(out, 0, sizeof(*out));
+	pthread_mutex_lock(&ctl);
+	out->hits = __atomic_load_n(&hits, __ATOMIC_RELAXED);
+	out->misses = __atomic_load_n(&misses, __ATOMIC_RELAXED);
+	for (c = counters; c; c = c->next) {
+		out->hits += __atomic_load_n(&c->hits, __ATOMIC_RELAXED);
+		out->misses += __atomic_load_n(&c->misses, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&ctl);
+	if (smack_epoch_enter() != 0)
+		return;
+	out->evictions = __atomic_load_n(&evictions, __ATOMIC_RELAXED);
+	out->invalidations = __atomic_load_n(&invalidations, __ATOMIC_RELAXED);
+	t = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+	if (t) {
+		out->memory = t->bucketcount * sizeof(t->buckets[0]);
+		for (i = 0; i < SHARDS; ++i) {
+			shard_t *sh = &t->shards[i];
+			pthread_mutex_lock(&sh->lock);
+			out->entries += sh->entries;
+			out->memory += sh->used;
+			pthread_mutex_unlock(&sh->lock);
+		}
+	}
+	smack_epoch_leave();
+}
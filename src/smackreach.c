@@ -0,0 +1,890 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "smackint.h"
+
+#define NONE UINT32_MAX
+
+/* The graph of the transition rules has a node for every label named in
+ * a rule, and a hub node for every subject pattern: the labels matching
+ * the pattern lead to its hub, and the hub leads to the labels matching
+ * the objects of its rules, so a pattern rule takes edges in the number
+ * of labels it matches rather than their product.
+ * The strongly connected components of the graph are found with
+ * Tarjan's algorithm, which completes every component after those it
+ * leads to. In that order, each component which leads anywhere gets a
+ * row: the bitset of the nodes reachable from its members, which is the
+ * union of the rows of its successors. Labels which are not named in
+ * any rule are only reachable through hubs, whose patterns are checked.
+ * A hub cannot tell which of its labels a deny rule applies to, so the
+ * labels a deny rule may apply to get no hub edges: they get an edge to
+ * each label of their hubs their own transition is allowed to.
+ */
+typedef struct graph_s {
+	size_t                 labels;    // nodes [0, labels) are labels, by ID
+	size_t                 hubs;      // the rest are hubs
+	smacklabel_id_t       *ids;       // the label of each label node
+	uint32_t              *byname;    // the label nodes sorted by name
+	smacklabel_id_t       *mapids;    // label ID -> node, open addressing
+	uint32_t              *mapnodes;
+	size_t                 mapsize;
+	struct smack_trienode *trie;
+	size_t                 nodes;
+	uint32_t              *hubof;     // object trie root -> hub node
+	uint32_t              *hubroot;   // hub -> object trie root
+	uint8_t               *denyhub;   // by hub, if its rules deny anything
+	uint32_t              *denied;    // the label nodes without hub edges
+	size_t                 ndenied;
+	uint8_t               *isdenied;  // by label node
+	uint32_t              *edgestart; // edges of node v: [edgestart[v], edgestart[v+1])
+	uint32_t              *edges;
+	uint32_t              *comp;      // the component of each node
+	uint32_t              *row;       // the row of each component, or NONE
+	uint64_t              *rows;
+	uint64_t              *scratch;   // a row for queries
+	size_t                 words;     // per row
+} graph_t;
+
+struct smackreach {
+	struct smacktrans_ctx *ctx;
+	pthread_mutex_t        lock;
+	unsigned long          generation;
+	graph_t               *graph;
+};
+
+static inline int testbit(const uint64_t *bits, size_t n)
+{
+	return (bits[n / 64] >> (n % 64)) & 1;
+}
+
+static inline void setbit(uint64_t *bits, size_t n)
+{
+	bits[n / 64] |= (uint64_t)1 << (n % 64);
+}
+
+static void freegraph(graph_t *g)
+{
+	if (!g)
+		return;
+	free(g->ids);
+	free(g->byname);
+	free(g->mapids);
+	free(g->mapnodes);
+	free(g->trie);
+	free(g->hubof);
+	free(g->hubroot);
+	free(g->denyhub);
+	free(g->denied);
+	free(g->isdenied);
+	free(g->edgestart);
+	free(g->edges);
+	free(g->comp);
+	free(g->row);
+	free(g->rows);
+	free(g->scratch);
+	free(g);
+}
+
+static uint32_t nodeof(const graph_t *g, smacklabel_id_t id)
+{
+	size_t i;
+
+	if (!id)
+		return NONE;
+	for (i = id & (g->mapsize-1); g->mapids[i]; i = (i+1) & (g->mapsize-1))
+		if (g->mapids[i] == id)
+			return g->mapnodes[i];
+	return NONE;
+}
+
+static const uint64_t *reachrow(const graph_t *g, uint32_t node)
+{
+	uint32_t row = g->row[g->comp[node]];
+
+	return row == NONE ? NULL : g->rows + (size_t)row * g->words;
+}
+
+/* The state of building a graph: the labels, then the edges. */
+typedef struct build_s {
+	graph_t         *g;
+	int              pass;    // 0 collecting labels, 1 collecting edges
+	int              failed;
+	smacklabel_id_t *ids;     // pass 0
+	size_t           nids;
+	size_t           idalloc;
+	uint32_t        *edges;   // pass 1: pairs of nodes
+	size_t           nedges;
+	size_t           edgealloc;
+	uint32_t        *later;   // the hub edges of denied labels
+	size_t           nlater;
+	size_t           lateralloc;
+	uint64_t        *denies;  // the denied pairs of nodes, sorted
+	size_t           ndenies;
+	uint32_t         hub;     // of the object trie being walked
+} build_t;
+
+static void addid(build_t *b, const char *label)
+{
+	smacklabel_id_t id = smack_intern(label);
+
+	if (b->nids == b->idalloc) {
+		size_t alloc = b->idalloc ? b->idalloc * 2 : 64;
+		smacklabel_id_t *ids = (smacklabel_id_t*)realloc(b->ids, alloc * sizeof(*ids));
+		if (!ids) {
+			b->failed = 1;
+			return;
+		}
+		b->ids = ids;
+		b->idalloc = alloc;
+	}
+	if (!id)
+		b->failed = 1;
+	else
+		b->ids[b->nids++] = id;
+}
+
+static void pushedge(build_t *b, uint32_t **list, size_t *count, size_t *alloc,
+                     uint32_t from, uint32_t to)
+{
+	if (*count == *alloc) {
+		size_t n = *alloc ? *alloc * 2 : 64;
+		uint32_t *edges = (uint32_t*)realloc(*list, n * 2 * sizeof(*edges));
+		if (!edges) {
+			b->failed = 1;
+			return;
+		}
+		*list = edges;
+		*alloc = n;
+	}
+	(*list)[2 * *count] = from;
+	(*list)[2 * *count + 1] = to;
+	++*count;
+}
+
+static void addedge(build_t *b, uint32_t from, uint32_t to)
+{
+	if (from == NONE || to == NONE)
+		return;
+	if (from < b->g->labels && to >= b->g->labels && b->g->isdenied[from])
+		pushedge(b, &b->later, &b->nlater, &b->lateralloc, from, to);
+	else
+		pushedge(b, &b->edges, &b->nedges, &b->edgealloc, from, to);
+}
+
+// Add edges between a node and every label starting with @prefix.
+static void addrange(build_t *b, uint32_t node, const char *prefix,
+                     size_t len, int tolabels)
+{
+	const graph_t *g = b->g;
+	size_t lo = 0, hi = g->labels;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (strcmp(smack_labelname(g->ids[g->byname[mid]]), prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < g->labels; ++lo) {
+		uint32_t label = g->byname[lo];
+		if (strncmp(smack_labelname(g->ids[label]), prefix, len) != 0)
+			break;
+		if (tolabels)
+			addedge(b, node, label);
+		else
+			addedge(b, label, node);
+	}
+}
+
+static uint32_t labelnode(const graph_t *g, const char *label)
+{
+	return nodeof(g, smack_labellookup(label));
+}
+
+static void visitobject(build_t *b, const char *str, size_t len, uint32_t node)
+{
+	uint8_t flags = b->g->trie[node].flags;
+
+	if (b->pass == 0) {
+		if (flags & SMACK_TRIE_EXACT)
+			addid(b, str);
+		return;
+	}
+	if (flags & SMACK_TRIE_EXACT)
+		addedge(b, b->hub, labelnode(b->g, str));
+	if (flags & SMACK_TRIE_PREFIX)
+		addrange(b, b->hub, str, len, 1);
+}
+
+static void walk(build_t *b, uint32_t node, char *buf, size_t len, int subject);
+
+static void visitsubject(build_t *b, const char *str, size_t len, uint32_t node)
+{
+	const struct smack_trienode *n = &b->g->trie[node];
+	char buf[SMACK_LONGLABEL];
+
+	if (n->exact) {
+		if (b->pass == 0)
+			addid(b, str);
+		else
+			addedge(b, labelnode(b->g, str), b->g->hubof[n->exact]);
+		b->hub = b->g->hubof ? b->g->hubof[n->exact] : NONE;
+		walk(b, n->exact, buf, 0, 0);
+	}
+	if (n->prefix) {
+		b->hub = b->g->hubof ? b->g->hubof[n->prefix] : NONE;
+		if (b->pass == 1)
+			addrange(b, b->hub, str, len, 0);
+		walk(b, n->prefix, buf, 0, 0);
+	}
+}
+
+// Visit every node of a trie with the string leading to it.
+static void walk(build_t *b, uint32_t node, char *buf, size_t len, int subject)
+{
+	uint32_t c;
+
+	buf[len] = 0;
+	if (subject)
+		visitsubject(b, buf, len, node);
+	else
+		visitobject(b, buf, len, node);
+	if (len + 1 >= SMACK_LONGLABEL)
+		return;
+	for (c = b->g->trie[node].child; c; c = b->g->trie[c].sibling) {
+		buf[len] = (char)b->g->trie[c].c;
+		walk(b, c, buf, len + 1, subject);
+	}
+}
+
+static int cmpid(const void *a, const void *b)
+{
+	smacklabel_id_t x = *(const smacklabel_id_t*)a;
+	smacklabel_id_t y = *(const smacklabel_id_t*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static const smacklabel_id_t *sortids;
+
+static int cmpname(const void *a, const void *b)
+{
+	return strcmp(smack_labelname(sortids[*(const uint32_t*)a]),
+	              smack_labelname(sortids[*(const uint32_t*)b]));
+}
+
+static pthread_mutex_t sortlock = PTHREAD_MUTEX_INITIALIZER;
+
+// Set up the label nodes from the collected IDs.
+static int addlabels(graph_t *g, build_t *b)
+{
+	size_t i, j;
+
+	qsort(b->ids, b->nids, sizeof(*b->ids), cmpid);
+	for (i = j = 0; i < b->nids; ++i)
+		if (!j || b->ids[i] != b->ids[j-1])
+			b->ids[j++] = b->ids[i];
+	g->labels = j;
+	g->ids = b->ids;
+	b->ids = NULL;
+
+	g->mapsize = 16;
+	while (g->mapsize < g->labels * 2)
+		g->mapsize *= 2;
+	g->mapids = (smacklabel_id_t*)calloc(g->mapsize, sizeof(*g->mapids));
+	g->mapnodes = (uint32_t*)malloc(g->mapsize * sizeof(*g->mapnodes));
+	g->byname = (uint32_t*)malloc((g->labels + 1) * sizeof(*g->byname));
+	if (!g->mapids || !g->mapnodes || !g->byname)
+		return -1;
+	for (i = 0; i < g->labels; ++i) {
+		for (j = g->ids[i] & (g->mapsize-1); g->mapids[j]; j = (j+1) & (g->mapsize-1))
+			;
+		g->mapids[j] = g->ids[i];
+		g->mapnodes[j] = (uint32_t)i;
+		g->byname[i] = (uint32_t)i;
+	}
+
+	// qsort() has no argument for the comparison
+	pthread_mutex_lock(&sortlock);
+	sortids = g->ids;
+	qsort(g->byname, g->labels, sizeof(*g->byname), cmpname);
+	pthread_mutex_unlock(&sortlock);
+	return 0;
+}
+
+// The flags of an object trie.
+static uint8_t trieflags(const struct smack_trienode *trie, uint32_t node)
+{
+	uint8_t flags = trie[node].flags;
+
+	for (node = trie[node].child; node; node = trie[node].sibling)
+		flags |= trieflags(trie, node);
+	return flags;
+}
+
+// Give every subject pattern a hub.
+static int addhubs(graph_t *g)
+{
+	size_t i;
+
+	g->hubof = (uint32_t*)malloc((g->nodes + 1) * sizeof(*g->hubof));
+	g->hubroot = (uint32_t*)malloc((g->nodes + 1) * sizeof(*g->hubroot));
+	g->denyhub = (uint8_t*)malloc(g->nodes + 1);
+	if (!g->hubof || !g->hubroot || !g->denyhub)
+		return -1;
+	for (i = 0; i < g->nodes; ++i)
+		g->hubof[i] = NONE;
+	for (i = 0; i < g->nodes; ++i) {
+		if (g->trie[i].exact) {
+			g->hubof[g->trie[i].exact] = (uint32_t)(g->labels + g->hubs);
+			g->hubroot[g->hubs++] = g->trie[i].exact;
+		}
+		if (g->trie[i].prefix) {
+			g->hubof[g->trie[i].prefix] = (uint32_t)(g->labels + g->hubs);
+			g->hubroot[g->hubs++] = g->trie[i].prefix;
+		}
+	}
+	for (i = 0; i < g->hubs; ++i)
+		g->denyhub[i] = !!(trieflags(g->trie, g->hubroot[i]) &
+		                   (SMACK_TRIE_DENYEXACT | SMACK_TRIE_DENYPREFIX));
+	return 0;
+}
+
+/* The hubs of the subject patterns matching a label, which are where
+ * its transitions lead, if it is not in a rule naming it.
+ */
+static size_t starthubs(const graph_t *g, const char *label, uint32_t *hubs)
+{
+	uint32_t node = 0;
+	size_t n = 0;
+
+	if (!g->nodes)
+		return 0;
+	for (; n < SMACK_LONGLABEL; ++label) {
+		if (g->trie[node].prefix)
+			hubs[n++] = g->hubof[g->trie[node].prefix];
+		if (!*label) {
+			if (g->trie[node].exact)
+				hubs[n++] = g->hubof[g->trie[node].exact];
+			break;
+		}
+		if (!(node = smack_triestep(g->trie, node, *label)))
+			break;
+	}
+	return n;
+}
+
+// Check if a deny pattern rule may apply to a label.
+static int denypattern(const graph_t *g, const char *label)
+{
+	uint32_t hubs[SMACK_LONGLABEL + 1];
+	size_t i, n;
+
+	n = starthubs(g, label, hubs);
+	for (i = 0; i < n; ++i)
+		if (g->denyhub[hubs[i] - g->labels])
+			return 1;
+	return 0;
+}
+
+static int cmpkey(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+// Find the labels a deny rule may apply to.
+static int adddenied(graph_t *g, build_t *b, const struct smack_transrules *rules)
+{
+	size_t i;
+
+	g->isdenied = (uint8_t*)calloc(g->labels + 1, 1);
+	g->denied = (uint32_t*)malloc((g->labels + 1) * sizeof(*g->denied));
+	b->denies = (uint64_t*)malloc((rules->ndenies + 1) * sizeof(*b->denies));
+	if (!g->isdenied || !g->denied || !b->denies)
+		return -1;
+	for (i = 0; i < rules->ndenies; ++i) {
+		uint32_t sub = nodeof(g, rules->denies[2*i]);
+		uint32_t obj = nodeof(g, rules->denies[2*i+1]);
+		g->isdenied[sub] = 1;
+		b->denies[b->ndenies++] = (uint64_t)sub << 32 | obj;
+	}
+	qsort(b->denies, b->ndenies, sizeof(*b->denies), cmpkey);
+	for (i = 0; i < g->labels; ++i) {
+		if (!g->isdenied[i] && denypattern(g, smack_labelname(g->ids[i])))
+			g->isdenied[i] = 1;
+		if (g->isdenied[i])
+			g->denied[g->ndenied++] = (uint32_t)i;
+	}
+	return 0;
+}
+
+// Sort the edges by their source.
+static int addedges(graph_t *g, build_t *b)
+{
+	size_t n = g->labels + g->hubs;
+	size_t i;
+
+	free(g->edgestart);
+	free(g->edges);
+	g->edgestart = (uint32_t*)calloc(n + 2, sizeof(*g->edgestart));
+	g->edges = (uint32_t*)malloc((b->nedges + 1) * sizeof(*g->edges));
+	if (!g->edgestart || !g->edges)
+		return -1;
+	for (i = 0; i < b->nedges; ++i)
+		++g->edgestart[b->edges[2*i] + 2];
+	for (i = 2; i < n + 2; ++i)
+		g->edgestart[i] += g->edgestart[i-1];
+	for (i = 0; i < b->nedges; ++i)
+		g->edges[g->edgestart[b->edges[2*i] + 1]++] = b->edges[2*i + 1];
+	return 0;
+}
+
+/* Replace the hub edges of the denied labels with edges to the labels
+ * of the hubs they are allowed to, then sort the edges again.
+ */
+static int adddeniededges(graph_t *g, build_t *b)
+{
+	size_t i;
+	uint32_t e;
+
+	if (!b->nlater)
+		return 0;
+	for (i = 0; i < b->nlater; ++i) {
+		uint32_t sub = b->later[2*i];
+		uint32_t hub = b->later[2*i + 1];
+		const char *subname = smack_labelname(g->ids[sub]);
+
+		for (e = g->edgestart[hub]; e < g->edgestart[hub+1]; ++e) {
+			uint32_t obj = g->edges[e];
+			uint64_t key = (uint64_t)sub << 32 | obj;
+
+			if (bsearch(&key, b->denies, b->ndenies, sizeof(key), cmpkey))
+				continue;
+			if (smack_trieverdict(g->trie, g->nodes, subname,
+			                      smack_labelname(g->ids[obj])) == SMACK_TRANS_ALLOW)
+				addedge(b, sub, obj);
+		}
+	}
+	if (b->failed)
+		return -1;
+	return addedges(g, b);
+}
+
+/* Find the strongly connected components, without recursion.
+ * Returns the number of components, or -1 if out of memory.
+ */
+static long tarjan(graph_t *g)
+{
+	size_t n = g->labels + g->hubs;
+	uint32_t *index, *low, *stack, *callnode, *calledge;
+	unsigned char *onstack;
+	uint32_t counter = 0, ncomp = 0;
+	size_t sp = 0, top, root;
+	long rc = -1;
+
+	index = (uint32_t*)malloc((n + 1) * sizeof(*index));
+	low = (uint32_t*)malloc((n + 1) * sizeof(*low));
+	stack = (uint32_t*)malloc((n + 1) * sizeof(*stack));
+	callnode = (uint32_t*)malloc((n + 1) * sizeof(*callnode));
+	calledge = (uint32_t*)malloc((n + 1) * sizeof(*calledge));
+	onstack = (unsigned char*)calloc(n + 1, 1);
+	g->comp = (uint32_t*)malloc((n + 1) * sizeof(*g->comp));
+	if (!index || !low || !stack || !callnode || !calledge || !onstack || !g->comp)
+		goto out;
+
+	for (root = 0; root < n; ++root)
+		index[root] = NONE;
+	for (root = 0; root < n; ++root) {
+		if (index[root] != NONE)
+			continue;
+		index[root] = low[root] = counter++;
+		stack[sp++] = root;
+		onstack[root] = 1;
+		callnode[0] = root;
+		calledge[0] = g->edgestart[root];
+		top = 1;
+		while (top) {
+			uint32_t v = callnode[top-1];
+			uint32_t w;
+
+			if (calledge[top-1] < g->edgestart[v+1]) {
+				w = g->edges[calledge[top-1]++];
+				if (index[w] == NONE) {
+					index[w] = low[w] = counter++;
+					stack[sp++] = w;
+					onstack[w] = 1;
+					callnode[top] = w;
+					calledge[top] = g->edgestart[w];
+					++top;
+				} else if (onstack[w] && index[w] < low[v])
+					low[v] = index[w];
+				continue;
+			}
+
+			--top;
+			if (low[v] == index[v]) {
+				do {
+					w = stack[--sp];
+					onstack[w] = 0;
+					g->comp[w] = ncomp;
+				} while (w != v);
+				++ncomp;
+			}
+			if (top && low[v] < low[callnode[top-1]])
+				low[callnode[top-1]] = low[v];
+		}
+	}
+	rc = ncomp;
+
+out:
+	free(index);
+	free(low);
+	free(stack);
+	free(callnode);
+	free(calledge);
+	free(onstack);
+	return rc;
+}
+
+/* Compute the row of every component which leads anywhere, after the
+ * rows of its successors.
+ */
+static int closure(graph_t *g, size_t ncomp)
+{
+	size_t n = g->labels + g->hubs;
+	uint32_t *start, *members;
+	size_t c, i, k, nrows = 0;
+	int rc = -1;
+
+	g->words = (n + 63) / 64;
+	g->row = (uint32_t*)malloc((ncomp + 1) * sizeof(*g->row));
+	g->scratch = (uint64_t*)malloc((g->words + 1) * sizeof(*g->scratch));
+	start = (uint32_t*)calloc(ncomp + 2, sizeof(*start));
+	members = (uint32_t*)malloc((n + 1) * sizeof(*members));
+	if (!g->row || !g->scratch || !start || !members)
+		goto out;
+
+	// the members of each component
+	for (i = 0; i < n; ++i)
+		++start[g->comp[i] + 2];
+	for (c = 2; c < ncomp + 2; ++c)
+		start[c] += start[c-1];
+	for (i = 0; i < n; ++i)
+		members[start[g->comp[i] + 1]++] = (uint32_t)i;
+
+	for (c = 0; c < ncomp; ++c) {
+		g->row[c] = NONE;
+		for (i = start[c]; i < start[c+1]; ++i) {
+			if (g->edgestart[members[i]] != g->edgestart[members[i] + 1]) {
+				g->row[c] = (uint32_t)nrows++;
+				break;
+			}
+		}
+	}
+	if (nrows && g->words > SIZE_MAX / sizeof(*g->rows) / nrows) {
+		errno = ENOMEM;
+		goto out;
+	}
+	g->rows = (uint64_t*)calloc(nrows * g->words + 1, sizeof(*g->rows));
+	if (!g->rows)
+		goto out;
+
+	for (c = 0; c < ncomp; ++c) {
+		uint64_t *bits;
+
+		if (g->row[c] == NONE)
+			continue;
+		bits = g->rows + (size_t)g->row[c] * g->words;
+		for (i = start[c]; i < start[c+1]; ++i) {
+			uint32_t v = members[i];
+			uint32_t e;
+
+			for (e = g->edgestart[v]; e < g->edgestart[v+1]; ++e) {
+				uint32_t w = g->edges[e];
+				const uint64_t *succ;
+
+				setbit(bits, w);
+				if (g->comp[w] == c || !(succ = reachrow(g, w)))
+					continue;
+				for (k = 0; k < g->words; ++k)
+					bits[k] |= succ[k];
+			}
+		}
+	}
+	rc = 0;
+
+out:
+	free(start);
+	free(members);
+	return rc;
+}
+
+static graph_t *buildgraph(struct smacktrans_ctx *ctx, unsigned long *generation)
+{
+	struct smack_transrules rules;
+	char buf[SMACK_LONGLABEL];
+	build_t b;
+	graph_t *g;
+	long ncomp;
+	size_t i;
+
+	if (smack_trans_rules(ctx, &rules) != 0)
+		return NULL;
+	*generation = rules.generation;
+
+	memset(&b, 0, sizeof(b));
+	g = (graph_t*)calloc(1, sizeof(*g));
+	if (!g)
+		goto nomem;
+	b.g = g;
+	g->trie = rules.trie;
+	g->nodes = rules.nodes;
+	rules.trie = NULL;
+
+	// the labels named in the rules
+	b.idalloc = 2 * (rules.count + rules.ndenies) + 64;
+	b.ids = (smacklabel_id_t*)malloc(b.idalloc * sizeof(*b.ids));
+	if (!b.ids)
+		goto nomem;
+	for (i = 0; i < 2 * rules.count; ++i)
+		b.ids[b.nids++] = rules.pairs[i];
+	for (i = 0; i < 2 * rules.ndenies; ++i)
+		b.ids[b.nids++] = rules.denies[i];
+	if (g->nodes)
+		walk(&b, 0, buf, 0, 1);
+	if (b.failed || addlabels(g, &b) != 0 || addhubs(g) != 0 ||
+	    adddenied(g, &b, &rules) != 0)
+		goto nomem;
+
+	// the edges between them
+	b.pass = 1;
+	for (i = 0; i < rules.count; ++i)
+		addedge(&b, nodeof(g, rules.pairs[2*i]), nodeof(g, rules.pairs[2*i+1]));
+	if (g->nodes)
+		walk(&b, 0, buf, 0, 1);
+	if (b.failed || addedges(g, &b) != 0 || adddeniededges(g, &b) != 0)
+		goto nomem;
+
+	ncomp = tarjan(g);
+	if (ncomp < 0 || closure(g, ncomp) != 0)
+		goto nomem;
+
+	free(b.ids);
+	free(b.edges);
+	free(b.later);
+	free(b.denies);
+	smack_trans_freerules(&rules);
+	return g;
+
+nomem:
+	free(b.ids);
+	free(b.edges);
+	free(b.later);
+	free(b.denies);
+	freegraph(g);
+	smack_trans_freerules(&rules);
+	errno = ENOMEM;
+	return NULL;
+}
+
+/* Get the graph of the current rules, rebuilding it if they changed.
+ * If that fails, the old one is used. Called with the lock held.
+ */
+static graph_t *current(struct smackreach *reach)
+{
+	unsigned long generation;
+	graph_t *g;
+
+	generation = smack_trans_generation(reach->ctx);
+	if (reach->graph && generation == reach->generation)
+		return reach->graph;
+	g = buildgraph(reach->ctx, &generation);
+	if (g) {
+		freegraph(reach->graph);
+		reach->graph = g;
+		reach->generation = generation;
+	}
+	return reach->graph;
+}
+
+/* Collect the nodes reachable from a label into the scratch row.
+ * Returns the row, which is NULL if nothing is reachable.
+ */
+static const uint64_t *reachable(graph_t *g, const char *from)
+{
+	uint32_t starts[SMACK_LONGLABEL + 1];
+	uint32_t v = labelnode(g, from);
+	const uint64_t *bits;
+	size_t i, k, n;
+	uint32_t e;
+
+	if (v != NONE)
+		return reachrow(g, v);
+
+	memset(g->scratch, 0, g->words * sizeof(*g->scratch));
+	n = starthubs(g, from, starts);
+	if (!denypattern(g, from)) {
+		for (i = 0; i < n; ++i) {
+			setbit(g->scratch, starts[i]);
+			if (!(bits = reachrow(g, starts[i])))
+				continue;
+			for (k = 0; k < g->words; ++k)
+				g->scratch[k] |= bits[k];
+		}
+		return g->scratch;
+	}
+
+	// the first step is checked as for the denied labels in the graph
+	for (i = 0; i < n; ++i) {
+		for (e = g->edgestart[starts[i]]; e < g->edgestart[starts[i]+1]; ++e) {
+			uint32_t w = g->edges[e];
+			if (testbit(g->scratch, w) ||
+			    smack_trieverdict(g->trie, g->nodes, from,
+			                      smack_labelname(g->ids[w])) != SMACK_TRANS_ALLOW)
+				continue;
+			setbit(g->scratch, w);
+			if (!(bits = reachrow(g, w)))
+				continue;
+			for (k = 0; k < g->words; ++k)
+				g->scratch[k] |= bits[k];
+		}
+	}
+	return g->scratch;
+}
+
+static int check(graph_t *g, const char *from, const char *to)
+{
+	const uint64_t *bits = reachable(g, from);
+	uint32_t t = labelnode(g, to);
+	size_t h, i;
+
+	if (t != NONE)
+		return bits && testbit(bits, t);
+
+	// a label not in the graph is reached by the patterns
+	if (smack_trieverdict(g->trie, g->nodes, from, to) == SMACK_TRANS_ALLOW)
+		return 1;
+	if (!bits)
+		return 0;
+	for (h = 0; h < g->hubs; ++h)
+		if (testbit(bits, g->labels + h) &&
+		    (smack_trieobject(g->trie, g->hubroot[h], to) & SMACK_TRANS_ALLOW))
+			return 1;
+	for (i = 0; i < g->ndenied; ++i)
+		if (testbit(bits, g->denied[i]) &&
+		    smack_trieverdict(g->trie, g->nodes, smack_labelname(g->ids[g->denied[i]]),
+		                      to) == SMACK_TRANS_ALLOW)
+			return 1;
+	return 0;
+}
+
+// List the labels in a row.
+static size_t listrow(const graph_t *g, const uint64_t *bits,
+                      smacklabel_id_t *out, size_t max)
+{
+	size_t count = 0;
+	size_t w;
+
+	for (w = 0; bits && w * 64 < g->labels; ++w) {
+		uint64_t x = bits[w];
+		while (x) {
+			size_t node = w * 64 + __builtin_ctzll(x);
+			if (node >= g->labels)
+				return count;
+			if (count < max)
+				out[count] = g->ids[node];
+			++count;
+			x &= x - 1;
+		}
+	}
+	return count;
+}
+
+static size_t list(graph_t *g, const char *from,
+                   smacklabel_id_t *out, size_t max)
+{
+	return listrow(g, reachable(g, from), out, max);
+}
+
+struct smackreach *smackreach_open(struct smacktrans_ctx *ctx)
+{
+	struct smackreach *reach;
+
+	if (!ctx)
+		ctx = smack_trans_default();
+	if (!ctx) {
+		errno = EINVAL;
+		return NULL;
+	}
+	reach = (struct smackreach*)calloc(1, sizeof(*reach));
+	if (!reach) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	reach->ctx = ctx;
+	pthread_mutex_init(&reach->lock, NULL);
+	if (!current(reach)) {
+		pthread_mutex_destroy(&reach->lock);
+		free(reach);
+		errno = ENOMEM;
+		return NULL;
+	}
+	return reach;
+}
+
+int smackreach_check(struct smackreach *reach, const char *from, const char *to)
+{
+	int rc;
+
+	if (!from || !to)
+		return 0;
+	if (!strcmp(from, to))
+		return 1;
+	pthread_mutex_lock(&reach->lock);
+	rc = check(current(reach), from, to);
+	pthread_mutex_unlock(&reach->lock);
+	return rc;
+}
+
+size_t smackreach_list(struct smackreach *reach, const char *from,
+                       smacklabel_id_t *out, size_t max)
+{
+	size_t count;
+
+	if (!from)
+		return 0;
+	pthread_mutex_lock(&reach->lock);
+	count = list(current(reach), from, out, max);
+	pthread_mutex_unlock(&reach->lock);
+	return count;
+}
+
+size_t smackreach_labels(struct smackreach *reach,
+                         smacklabel_id_t *out, size_t max)
+{
+	const graph_t *g;
+	size_t count;
+
+	pthread_mutex_lock(&reach->lock);
+	g = current(reach);
+	count = g->labels;
+	if (max)
+		memcpy(out, g->ids, (count < max ? count : max) * sizeof(*out));
+	pthread_mutex_unlock(&reach->lock);
+	return count;
+}
+
+void smackreach_close(struct smackreach *reach)
+{
+	if (!reach)
+		return;
+	freegraph(reach->graph);
+	pthread_mutex_destroy(&reach->lock);
+	free(reach);
+}
@@ -0,0 +1,163 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "smackint.h"
+
+struct smacksession {
+	int      dirfd;     // the smackfs mount
+	int      longiface; // the kernel provides the access2 interface
+	unsigned forkgen;   // the fork generation dirfd belongs to
+	char     request[SMACK_REQUESTSIZE];
+};
+
+// Bumped in the child after a fork, so sessions notice they were inherited.
+static unsigned forkgen;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static void session_atfork_child(void)
+{
+	++forkgen;
+}
+
+static void session_atfork_init(void)
+{
+	pthread_atfork(NULL, NULL, session_atfork_child);
+}
+
+static int session_attach(struct smacksession *s)
+{
+	s->dirfd = open(SMACK_FS, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (s->dirfd < 0) {
+		if (errno == ENOENT)
+			errno = ENOSYS;
+		return -1;
+	}
+	s->longiface = (smackinterfaces() & SMACK_IFACE_ACCESS2) != 0;
+	s->forkgen = forkgen;
+	return 0;
+}
+
+// Start over in a forked child rather than using what the parent set up.
+static int session_prepare(struct smacksession *s)
+{
+	if (s->forkgen == forkgen && s->dirfd >= 0)
+		return 0;
+	if (s->dirfd >= 0)
+		close(s->dirfd);
+	return session_attach(s);
+}
+
+/* The kernel only allows one write per open, so every transaction
+ * needs a fresh file, but thanks to dirfd this is a single path
+ * component lookup.
+ */
+static int session_transact(struct smacksession *s, const char *path,
+                            size_t size)
+{
+	// skip the leading "/smack/" of the full path
+	return smack_transact(s->dirfd, path + sizeof(SMACK_FS),
+	                      s->request, size);
+}
+
+int smack_session_checkn(struct smacksession *s,
+                         const char *subject, size_t sublen,
+                         const char *object, size_t objlen,
+                         const char *rwxat)
+{
+	size_t size;
+	int rc;
+
+	if (session_prepare(s) != 0)
+		return 0;
+
+	errno = 0;
+
+	if (sublen >= SMACK_LONGLABEL-1 || objlen >= SMACK_LONGLABEL-1) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (s->longiface) {
+		size = smack_request_long(s->request, subject, sublen,
+		                          object, objlen, rwxat);
+		rc = session_transact(s, SMACK_ACCESS2, size);
+		return rc < 0 ? 0 : rc;
+	}
+
+	if (sublen >= SMACK_SIZE-1 || objlen >= SMACK_SIZE-1) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	size = smack_request_legacy(s->request, subject, sublen,
+	                            object, objlen, rwxat);
+	rc = session_transact(s, SMACK_ACCESS, size);
+	return rc < 0 ? 0 : rc;
+}
+
+static int session_check(struct smacksession *s,
+                         const char *subject, const char *object,
+                         const char *rwxat)
+{
+	return smack_session_checkn(s, subject, strlen(subject),
+	                            object, strlen(object), rwxat);
+}
+
+struct smacksession *smacksession_open(void)
+{
+	struct smacksession *s;
+
+	pthread_once(&atfork_once, session_atfork_init);
+
+	s = (struct smacksession*)malloc(sizeof(*s));
+	if (!s) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (session_attach(s) != 0) {
+		int eno = errno;
+		free(s);
+		errno = eno;
+		return NULL;
+	}
+	return s;
+}
+
+int smacksession_access(struct smacksession *s,
+                        const char *subject, const char *object,
+                        const char *access)
+{
+	char rwxat[SMACK_ACCESSLEN];
+
+	if (smack_parseaccess(access, rwxat) != 0) {
+		errno = EINVAL;
+		return 0;
+	}
+	return session_check(s, subject, object, rwxat);
+}
+
+int smacksession_mayaccess(struct smacksession *s,
+                           const char *subject, const char *object,
+                           int may)
+{
+	char rwxat[SMACK_ACCESSLEN];
+
+	smack_setaccess(may, rwxat);
+	return session_check(s, subject, object, rwxat);
+}
+
+void smacksession_close(struct smacksession *s)
+{
+	if (!s)
+		return;
+	if (s->dirfd >= 0)
+		close(s->dirfd);
+	free(s);
+}
@@ -0,0 +1,357 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "smackint.h"
+
+/* A decision cache shared between processes through a mapped file.
+ * The file holds a header and a fixed number of slots, each of which
+ * caches one subject/object pair with both labels stored inline. Pairs
+ * are placed by open addressing with a short probe sequence.
+ * Slots are guarded by a sequence counter which is odd while a writer
+ * changes the slot. Readers never lock: they copy the slot and check
+ * the counter again, a slot which changed under them is simply a miss.
+ * Each slot records the policy generation it was filled under, entries
+ * of other generations are ignored. The generation is a counter in the
+ * header, which smackcache_invalidate() bumps after new rules were
+ * loaded (smackload does so), so checking it costs a load instead of
+ * reading the rules.
+ */
+#define SHM_MAGIC    0x434b4d53u // "SMKC"
+#define SHM_VERSION  2
+#define SHM_SLOTS    4096
+#define SHM_PROBES   4
+#define SHM_LABELS   102
+
+typedef struct shmheader_s {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slots;
+	uint32_t slotsize;
+	uint64_t generation; // never 0
+	char     reserved[40];
+} shmheader_t;
+
+typedef struct shmslot_s {
+	uint32_t seq;
+	uint32_t hash;
+	uint64_t generation;
+	uint32_t allow;
+	uint32_t deny;
+	uint8_t  sublen;
+	uint8_t  objlen;
+	char     labels[SHM_LABELS]; // subject and object, not terminated
+} shmslot_t;
+
+typedef char shmslot_size_check[sizeof(shmslot_t) == 128 ? 1 : -1];
+
+typedef struct mapping_s {
+	struct smack_epoch_node node;
+	shmheader_t *base;
+	size_t     size;
+	shmslot_t *slots;
+	size_t     mask;
+	int        writable;
+} mapping_t;
+
+int smack_shmcache_attached;
+
+static mapping_t      *current;
+
+static void unmap(struct smack_epoch_node *node)
+{
+	mapping_t *m = (mapping_t*)node;
+
+	munmap(m->base, m->size);
+	free(m);
+}
+
+// Copy a slot, returns 0 if it is being written or changed meanwhile.
+static int readslot(const shmslot_t *slot, shmslot_t *out)
+{
+	uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+	if (seq & 1)
+		return 0;
+	memcpy(out, slot, sizeof(*out));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq;
+}
+
+static int matches(const shmslot_t *slot, uint32_t hash, uint64_t gen,
+                   const char *subject, size_t sublen,
+                   const char *object, size_t objlen)
+{
+	return slot->hash == hash && slot->generation == gen &&
+	       slot->sublen == sublen && slot->objlen == objlen &&
+	       !memcmp(slot->labels, subject, sublen) &&
+	       !memcmp(slot->labels + sublen, object, objlen);
+}
+
+int smack_shmcache_lookup(const char *subject, size_t sublen,
+                          const char *object, size_t objlen,
+                          int may)
+{
+	shmslot_t copy;
+	mapping_t *m;
+	uint64_t gen = 0;
+	uint32_t hash;
+	int i, rc = -1;
+
+	if (sublen + objlen > SHM_LABELS)
+		return -1;
+	hash = smack_cache_pairhash(subject, sublen, object, objlen);
+
+	if (smack_epoch_enter() != 0)
+		return -1;
+	m = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+	if (m)
+		gen = __atomic_load_n(&m->base->generation, __ATOMIC_ACQUIRE);
+	for (i = 0; m && i < SHM_PROBES; ++i) {
+		if (readslot(&m->slots[(hash + i) & m->mask], &copy) &&
+		    matches(&copy, hash, gen, subject, sublen, object, objlen)) {
+			rc = smack_cache_decide(copy.allow, copy.deny, may & 31);
+			break;
+		}
+	}
+	smack_epoch_leave();
+	return rc;
+}
+
+void smack_shmcache_store(const char *subject, size_t sublen,
+                          const char *object, size_t objlen,
+                          int may, int allowed)
+{
+	shmslot_t copy;
+	shmslot_t *slot = NULL, *stale = NULL;
+	mapping_t *m;
+	uint64_t gen = 0;
+	uint32_t hash, seq;
+	int i, same = 0;
+
+	if (sublen + objlen > SHM_LABELS)
+		return;
+	hash = smack_cache_pairhash(subject, sublen, object, objlen);
+
+	if (smack_epoch_enter() != 0)
+		return;
+	m = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+	if (!m || !m->writable)
+		goto out;
+	gen = __atomic_load_n(&m->base->generation, __ATOMIC_ACQUIRE);
+
+	// the pair's own slot, or else one of another generation
+	for (i = 0; i < SHM_PROBES; ++i) {
+		shmslot_t *s = &m->slots[(hash + i) & m->mask];
+		if (!readslot(s, &copy))
+			continue;
+		if (matches(&copy, hash, gen, subject, sublen, object, objlen)) {
+			slot = s;
+			break;
+		}
+		if (!stale && copy.generation != gen)
+			stale = s;
+	}
+	if (!slot)
+		slot = stale ? stale : &m->slots[hash & m->mask];
+
+	seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+	if ((seq & 1) ||
+	    !__atomic_compare_exchange_n(&slot->seq, &seq, seq + 1, 0,
+	                                 __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+		goto out; // someone else is writing it
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	same = matches(slot, hash, gen, subject, sublen, object, objlen);
+	if (!same) {
+		slot->hash = hash;
+		slot->generation = gen;
+		slot->allow = 0;
+		slot->deny = 0;
+		slot->sublen = (uint8_t)sublen;
+		slot->objlen = (uint8_t)objlen;
+		memcpy(slot->labels, subject, sublen);
+		memcpy(slot->labels + sublen, object, objlen);
+	}
+	if (allowed)
+		slot->allow |= 1u << (may & 31);
+	else
+		slot->deny |= 1u << (may & 31);
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+out:
+	smack_epoch_leave();
+}
+
+/* Only trust files which nobody but root could have written. Which
+ * root processes may write it is up to the file's Smack label.
+ */
+static int trusted(const struct stat *st)
+{
+	if (!S_ISREG(st->st_mode) || st->st_uid != 0)
+		return 0;
+	return !(st->st_mode & (S_IWGRP | S_IWOTH));
+}
+
+static int create(const char *path)
+{
+	char dir[SMACK_LONGLABEL];
+	const char *slash = strrchr(path, '/');
+	int fd;
+
+	if (slash && slash != path && (size_t)(slash - path) < sizeof(dir)) {
+		memcpy(dir, path, slash - path);
+		dir[slash - path] = 0;
+		if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+			return -1;
+	}
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	return fd;
+}
+
+// Called with an exclusive lock on the file.
+static int initialize(int fd, size_t slots)
+{
+	shmheader_t header;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = SHM_MAGIC;
+	header.version = SHM_VERSION;
+	header.slots = (uint32_t)slots;
+	header.slotsize = sizeof(shmslot_t);
+	header.generation = 1;
+	if (ftruncate(fd, sizeof(header) + slots * sizeof(shmslot_t)) != 0)
+		return -1;
+	if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+		return -1;
+	return 0;
+}
+
+int smackshmcache_attach(const char *path, size_t slots, int flags)
+{
+	struct stat st;
+	shmheader_t *header;
+	mapping_t *m, *old;
+	int fd, eno;
+	int writable = 1;
+	size_t n;
+
+	if (!path)
+		path = SMACK_SHMCACHE;
+	if (!slots)
+		slots = SHM_SLOTS;
+	for (n = SHM_PROBES; n < slots; n *= 2)
+		;
+	slots = n;
+
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	// a file created by anyone else would not be trusted
+	if (fd < 0 && errno == ENOENT && (flags & SMACK_SHMCACHE_CREATE) &&
+	    geteuid() == 0)
+		fd = create(path);
+	if (fd < 0 && (errno == EACCES || errno == EROFS)) {
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		writable = 0;
+	}
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) != 0)
+		goto fail;
+	if (!trusted(&st)) {
+		errno = EPERM;
+		goto fail;
+	}
+	if (writable && st.st_size == 0) {
+		if (flock(fd, LOCK_EX) != 0)
+			goto fail;
+		if ((fstat(fd, &st) != 0) ||
+		    (st.st_size == 0 && initialize(fd, slots) != 0) ||
+		    fstat(fd, &st) != 0) {
+			eno = errno;
+			flock(fd, LOCK_UN);
+			errno = eno;
+			goto fail;
+		}
+		flock(fd, LOCK_UN);
+	}
+	if ((size_t)st.st_size < sizeof(*header)) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	m = (mapping_t*)calloc(1, sizeof(*m));
+	if (!m) {
+		errno = ENOMEM;
+		goto fail;
+	}
+	m->size = st.st_size;
+	m->writable = writable;
+	m->base = mmap(NULL, m->size, PROT_READ | (writable ? PROT_WRITE : 0),
+	               MAP_SHARED, fd, 0);
+	if (m->base == MAP_FAILED) {
+		free(m);
+		goto fail;
+	}
+	close(fd);
+
+	header = m->base;
+	if (header->magic != SHM_MAGIC || header->version != SHM_VERSION ||
+	    !header->generation ||
+	    header->slotsize != sizeof(shmslot_t) ||
+	    header->slots < SHM_PROBES || (header->slots & (header->slots - 1)) ||
+	    sizeof(*header) + (size_t)header->slots * sizeof(shmslot_t) > m->size) {
+		munmap(m->base, m->size);
+		free(m);
+		errno = EINVAL;
+		return -1;
+	}
+	m->slots = (shmslot_t*)(header + 1);
+	m->mask = header->slots - 1;
+
+	old = __atomic_exchange_n(&current, m, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&smack_shmcache_attached, 1, __ATOMIC_RELAXED);
+	if (old)
+		smack_epoch_retire(&old->node, unmap);
+	return 0;
+
+fail:
+	eno = errno;
+	close(fd);
+	errno = eno;
+	return -1;
+}
+
+void smackshmcache_detach(void)
+{
+	mapping_t *old;
+
+	__atomic_store_n(&smack_shmcache_attached, 0, __ATOMIC_RELAXED);
+	old = __atomic_exchange_n(&current, NULL, __ATOMIC_SEQ_CST);
+	if (old)
+		smack_epoch_retire(&old->node, unmap);
+}
+
+void smack_shmcache_invalidate(void)
+{
+	mapping_t *m;
+	uint64_t gen = 0;
+
+	if (smack_epoch_enter() != 0)
+		return;
+	m = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+	if (m && m->writable) {
+		gen = __atomic_add_fetch(&m->base->generation, 1, __ATOMIC_ACQ_REL);
+		// 0 is never a generation
+		if (!gen)
+			__atomic_compare_exchange_n(&m->base->generation, &gen, 1, 0,
+			                            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+	}
+	smack_epoch_leave();
+}
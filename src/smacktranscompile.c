@@ -0,0 +1,104 @@
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+
+#include "smack.h"
+
+static struct option lopts[] = {
+	{ "help",      no_argument,       NULL, 'h' },
+	{ "verbose",   no_argument,       NULL, 'v' },
+	{ "file",      required_argument, NULL, 'f' },
+	{ "dir",       required_argument, NULL, 'd' },
+	{ "output",    required_argument, NULL, 'o' },
+	{ "force",     no_argument,       NULL, 'F' },
+
+	{ NULL, 0, NULL, 0 }
+};
+
+static void usage(const char *arg0, FILE *target, int exitstatus)
+{
+	fprintf(target, "usage: %s [options]\n", arg0);
+	fprintf(target,
+	"options:\n"
+	"  -h, --help            show this help message\n"
+	"  -v, --verbose         print the number of rules compiled\n"
+	"  -f, --file=path       read rules from this file instead of\n"
+	"                        " SMACK_TRANSITION_FILE "\n"
+	"  -d, --dir=path        read rules from the files in this directory\n"
+	"                        instead of " SMACK_TRANSITION_DIR "\n"
+	"  -o, --output=path     write the database to this file instead of\n"
+	"                        " SMACK_TRANSITION_DB "\n"
+	"  -F, --force           write the database even if the rules have\n"
+	"                        syntax errors, without the lines in error\n"
+	);
+	exit(exitstatus);
+}
+
+static const char *opt_file = NULL;
+static const char *opt_dir = NULL;
+static const char *opt_output = NULL;
+static int         opt_verbose = 0;
+static int         opt_flags = 0;
+
+static void checkargs(int argc, char **argv)
+{
+	int o;
+	int lind = 0;
+
+	while ( (o = getopt_long(argc, argv, "+hvf:d:o:F", lopts, &lind)) != -1 ) {
+		switch (o)
+		{
+			case 'h':
+				usage(argv[0], stdout, 0);
+				break;
+			case 'v':
+				opt_verbose = 1;
+				break;
+			case 'f':
+				opt_file = optarg;
+				break;
+			case 'd':
+				opt_dir = optarg;
+				break;
+			case 'o':
+				opt_output = optarg;
+				break;
+			case 'F':
+				opt_flags |= SMACK_TRANS_FORCE;
+				break;
+			default:
+				usage(argv[0], stderr, 1);
+				break;
+		};
+	}
+
+	if (optind != argc)
+		usage(argv[0], stderr, 1);
+}
+
+int main(int argc, char **argv)
+{
+	int rules;
+
+	checkargs(argc, argv);
+
+	rules = smacktrans_compile2(opt_file, opt_dir, opt_output, opt_flags);
+	if (rules < 0 && errno == EBADMSG) {
+		fprintf(stderr, "%s: the rules have errors, %s is unchanged"
+		        " (use --force to compile them anyway)\n", argv[0],
+		        opt_output ? opt_output : SMACK_TRANSITION_DB);
+		return 1;
+	}
+	if (rules < 0) {
+		fprintf(stderr, "%s: failed to write %s: %s\n", argv[0],
+		        opt_output ? opt_output : SMACK_TRANSITION_DB,
+		        strerror(errno));
+		return 1;
+	}
+	if (opt_verbose)
+		printf("%d transition rules\n", rules);
+	return 0;
+}
@@ -4,117 +4,572 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <time.h>
 #include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
 
-#include "smack.h"
+#include "smackint.h"
 
-typedef struct rule_s {
-	char subject[SMACK_LONGLABEL];
-	char object[SMACK_LONGLABEL];
-	struct rule_s *next;
-} rule_t;
+#define VALID_TRANSITION_D_ENTRY(x) ( (x)[0] && (x)[0] != '.' )
 
-typedef struct filecache_s {
-	char   filename[256];
-	time_t readtime;
-	time_t checktime;
-	struct filecache_s *next;
-} filecache_t;
+#define TRANS_MAXTHREADS 8
 
-#define VALID_TRANSITION_D_ENTRY(x) ( (x)[0] && (x)[0] != '.' )
+/* Rules with a trailing '*' on either side are patterns, which are
+ * compiled into a trie, see struct smack_trienode. A lookup walks the
+ * subject once, and the objects of each subject pattern matching on the
+ * way, so it only depends on the length of the labels and not on the
+ * number of rules.
+ * A rule written with '!->' denies the transition, and wins over every
+ * rule allowing it, whichever file they are in.
+ */
+typedef struct smack_trienode trienode_t;
 
-static rule_t *rules;
-#ifdef SMACK_TRANSITION_FILE
-static filecache_t fc_file = { {0}, 0 };
-#endif
-#ifdef SMACK_TRANSITION_DIR
-static filecache_t *fc_dir = NULL;
+/* The compiled database, see smacktrans_compile(), in the byte order
+ * of the machine which wrote it:
+ *   the header,
+ *   the index: an open addressing table of slots, hashed with
+ *     smack_cache_pairhash() of the labels, with the verdict of the pair,
+ *   the trie of the pattern rules,
+ *   the labels: NUL terminated strings, each stored once, starting
+ *     with an empty one so offset 0 marks a free slot.
+ * It is mapped and queried in place.
+ */
+#define TRANSDB_MAGIC     "SMKT"
+#define TRANSDB_VERSION   3
+#define TRANSDB_BYTEORDER 0x01020304
+
+typedef struct transdb_header_s {
+	char     magic[4];
+	uint32_t version;
+	uint32_t byteorder;
+	uint32_t checksum;  // CRC-32 of everything behind the header
+	uint32_t rules;
+	uint32_t slots;     // a power of two
+	uint32_t nodes;     // of the trie
+	uint32_t unused;
+	uint64_t index;     // file offsets
+	uint64_t trie;
+	uint64_t labels;
+	uint64_t labelsize;
+	uint64_t size;      // of the whole file
+} transdb_header_t;
+
+#define TRANSDB_DENY 1
+
+typedef struct transdb_slot_s {
+	uint32_t hash;
+	uint32_t subject; // offsets into the labels
+	uint32_t object;
+	uint32_t flags;   // TRANSDB_DENY
+} transdb_slot_t;
 
-static void addcache(const char *filename, time_t now)
+// What a database was mapped from.
+typedef struct dbstamp_s {
+	dev_t           dev;
+	ino_t           ino;
+	off_t           size;
+	struct timespec mtime;
+} dbstamp_t;
+
+/* The rules of a context are published as an immutable snapshot: a set
+ * of (subject, object) pairs of interned labels in an open addressing
+ * table, so a lookup is a single probe sequence and each label is only
+ * stored once, in the label arena. A reload builds a new snapshot and
+ * swaps it in, so readers never take a lock nor see a half built one.
+ * Replaced snapshots are freed through the epoch module.
+ * The pattern rules are in a trie beside them.
+ * A snapshot of a compiled database holds its mapping instead.
+ */
+typedef struct snapshot_s {
+	struct smack_epoch_node node;
+	uint64_t *pairs; // subject << 32 | object | PAIR_DENY, 0 marks a free slot
+	size_t    size;
+	size_t    count;
+	const trienode_t *trie;
+	size_t    nodes;
+	size_t    patterns;
+	const transdb_header_t *db;
+	dbstamp_t stamp;
+} snapshot_t;
+
+typedef struct pairlist_s {
+	uint64_t *pairs;
+	size_t    count;
+	size_t    alloc;
+} pairlist_t;
+
+/* Every file read keeps its rules in a block, together with the
+ * fingerprint of the file it was parsed from, so a refresh only parses
+ * the files which were added or changed since, and only builds a new
+ * snapshot when a block changed. Patterns are interned like labels.
+ * The blocks are kept in file order: the transition file, then the
+ * directory's files by name. Files are parsed in parallel, and their
+ * errors reported in this order afterwards.
+ */
+typedef struct fileblock_s {
+	struct fileblock_s *next;
+	char           *path;
+	dev_t           dev;
+	ino_t           ino;
+	off_t           size;
+	struct timespec mtime;
+	int             racy;  // modified too shortly before it was read
+	int             seen;  // still exists, during a scan
+	int             pending; // to be parsed, during a scan
+	int             failed;  // could not be read, during a scan
+	pairlist_t      rules;    // the rules of the file
+	pairlist_t      patterns; // and its pattern rules
+	unsigned long  *errors;   // the lines which could not be parsed
+	size_t          nerrors;
+	size_t          erroralloc;
+} fileblock_t;
+
+struct smacktrans_ctx {
+	const char      *file;     // the transition file, or NULL
+	const char      *dir;      // the transition directory, or NULL
+	const char      *db;       // the compiled database, or NULL
+	dbstamp_t        baddb;    // a database which failed to verify
+	snapshot_t      *snapshot; // the current rules, read without locking
+	unsigned long    generation; // of the snapshot
+	pthread_mutex_t  lock;     // serializes reloads, protects the blocks
+	fileblock_t     *blocks;
+	int              stale;    // the snapshot could not be rebuilt
+	// change detection, see below
+	int              changed;
+	int              watched;  // 0 before the first try, 1 watched, -1 not
+	int              wd_fileparent;
+	int              wd_dirparent;
+	int              wd_dir;
+	int              wd_dbparent;
+	struct smacktrans_ctx *next; // in the list of contexts
+};
+
+/* The verdict is kept in the key, as label IDs never get near 2^31, so
+ * a single probe sequence settles a pair.
+ */
+#define PAIR_DENY ((uint64_t)1 << 63)
+
+static inline uint64_t pairkey(smacklabel_id_t sub, smacklabel_id_t obj)
 {
-	filecache_t *ent = (filecache_t*)malloc(sizeof(filecache_t));
-	strncpy(ent->filename, filename, sizeof(ent->filename));
-	ent->readtime = now;
-	ent->next = fc_dir;
-	ent->checktime = now;
-	fc_dir = ent;
+	return (uint64_t)sub << 32 | obj;
 }
-#endif
 
-static void clearcache()
+static inline smacklabel_id_t pairsub(uint64_t key)
 {
-#ifdef SMACK_TRANSITION_FILE
-	fc_file.readtime = 0;
-#endif
-#ifdef SMACK_TRANSITION_DIR
-	while (fc_dir) {
-		filecache_t *cur = fc_dir;
-		fc_dir = cur->next;
-		free(cur);
+	return (smacklabel_id_t)((key & ~PAIR_DENY) >> 32);
+}
+
+static inline smacklabel_id_t pairobj(uint64_t key)
+{
+	return (smacklabel_id_t)key;
+}
+
+static inline size_t pairslot(uint64_t key, size_t size)
+{
+	return (size_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & (size-1);
+}
+
+// Returns SMACK_TRANS_ALLOW, SMACK_TRANS_DENY, or 0 without a rule.
+static int pairverdict(const snapshot_t *snap,
+                       smacklabel_id_t sub, smacklabel_id_t obj)
+{
+	uint64_t key = pairkey(sub, obj);
+	size_t i;
+
+	if (!snap || !snap->count)
+		return 0;
+	for (i = pairslot(key, snap->size); snap->pairs[i]; i = (i+1) & (snap->size-1))
+		if ((snap->pairs[i] & ~PAIR_DENY) == key)
+			return snap->pairs[i] & PAIR_DENY ? SMACK_TRANS_DENY : SMACK_TRANS_ALLOW;
+	return 0;
+}
+
+typedef struct trie_s {
+	trienode_t *nodes;
+	size_t      count;
+	size_t      alloc;
+} trie_t;
+
+// Add a node. Returns its index, 0 if out of memory.
+static uint32_t trienode(trie_t *t, unsigned char c)
+{
+	if (t->count == t->alloc) {
+		size_t alloc = t->alloc ? t->alloc * 2 : 64;
+		trienode_t *nodes = (trienode_t*)realloc(t->nodes, alloc * sizeof(*nodes));
+		if (!nodes || alloc > UINT32_MAX)
+			return 0;
+		t->nodes = nodes;
+		t->alloc = alloc;
 	}
-#endif
-	while (rules) {
-		rule_t *cur = rules;
-		rules = rules->next;
-		free(cur);
+	memset(&t->nodes[t->count], 0, sizeof(*t->nodes));
+	t->nodes[t->count].c = c;
+	return (uint32_t)t->count++;
+}
+
+/* Walk the part of a pattern before its '*' from @node on, adding the
+ * nodes which are missing.
+ * Returns 1 if the pattern ends with '*', 0 if not, -1 if out of memory.
+ */
+static int triepath(trie_t *t, uint32_t *node, const char *pattern)
+{
+	uint32_t next, last;
+
+	for (; *pattern && *pattern != '*'; ++pattern) {
+		unsigned char c = (unsigned char)*pattern;
+
+		last = 0;
+		for (next = t->nodes[*node].child; next; next = t->nodes[next].sibling) {
+			if (t->nodes[next].c == c)
+				break;
+			last = next;
+		}
+		if (!next) {
+			// behind the older siblings
+			if (!(next = trienode(t, c)))
+				return -1;
+			if (last)
+				t->nodes[last].sibling = next;
+			else
+				t->nodes[*node].child = next;
+		}
+		*node = next;
+	}
+	return *pattern == '*';
+}
+
+/* Add a pattern rule.
+ * Returns 1 if it is new, 0 if not, -1 if out of memory.
+ */
+static int trieadd(trie_t *t, const char *sub, const char *obj, int deny)
+{
+	uint32_t node = 0, root;
+	int prefix;
+
+	// the root is the only node added without a parent
+	if (!t->count) {
+		trienode(t, 0);
+		if (!t->count)
+			return -1;
+	}
+	prefix = triepath(t, &node, sub);
+	if (prefix < 0)
+		return -1;
+	root = prefix ? t->nodes[node].prefix : t->nodes[node].exact;
+	if (!root) {
+		if (!(root = trienode(t, 0)))
+			return -1;
+		if (prefix)
+			t->nodes[node].prefix = root;
+		else
+			t->nodes[node].exact = root;
+	}
+
+	prefix = triepath(t, &root, obj);
+	if (prefix < 0)
+		return -1;
+	if (deny)
+		prefix = prefix ? SMACK_TRIE_DENYPREFIX : SMACK_TRIE_DENYEXACT;
+	else
+		prefix = prefix ? SMACK_TRIE_PREFIX : SMACK_TRIE_EXACT;
+	if (t->nodes[root].flags & prefix)
+		return 0;
+	t->nodes[root].flags |= prefix;
+	return 1;
+}
+
+static inline const transdb_slot_t *dbslots(const transdb_header_t *db)
+{
+	return (const transdb_slot_t*)((const char*)db + db->index);
+}
+
+static inline const trienode_t *dbtrie(const transdb_header_t *db)
+{
+	return (const trienode_t*)((const char*)db + db->trie);
+}
+
+static inline const char *dblabels(const transdb_header_t *db)
+{
+	return (const char*)db + db->labels;
+}
+
+// Returns SMACK_TRANS_ALLOW, SMACK_TRANS_DENY, or 0 without a rule.
+static int dbverdict(const transdb_header_t *db,
+                     const char *sub, const char *obj)
+{
+	const transdb_slot_t *slots = dbslots(db);
+	const char *labels = dblabels(db);
+	uint32_t hash = smack_cache_pairhash(sub, strlen(sub), obj, strlen(obj));
+	size_t i;
+
+	for (i = hash & (db->slots-1); slots[i].subject; i = (i+1) & (db->slots-1))
+		if (slots[i].hash == hash &&
+		    !strcmp(labels + slots[i].subject, sub) &&
+		    !strcmp(labels + slots[i].object, obj))
+			return slots[i].flags & TRANSDB_DENY ? SMACK_TRANS_DENY
+			                                     : SMACK_TRANS_ALLOW;
+	return 0;
+}
+
+/* Check a rule given by names or interned labels, whichever the
+ * snapshot needs is looked up from the other. The verdict of a pair in
+ * the index already includes the pattern rules denying it.
+ */
+static int snaphasrule(const snapshot_t *snap,
+                       const char *sub, const char *obj,
+                       smacklabel_id_t subid, smacklabel_id_t objid)
+{
+	int verdict = 0;
+
+	if (!snap)
+		return 0;
+	if (!snap->db) {
+		// labels which were never interned cannot appear in any rule
+		if (sub) {
+			subid = smack_labellookup(sub);
+			objid = smack_labellookup(obj);
+		}
+		if (subid && objid)
+			verdict = pairverdict(snap, subid, objid);
+		if (verdict || !snap->nodes)
+			return verdict == SMACK_TRANS_ALLOW;
+	}
+	if (!sub)
+		sub = smack_labelname(subid);
+	if (!obj)
+		obj = smack_labelname(objid);
+	if (!sub || !obj)
+		return 0;
+	if (snap->db)
+		verdict = dbverdict(snap->db, sub, obj);
+	if (!verdict)
+		verdict = smack_trieverdict(snap->trie, snap->nodes, sub, obj);
+	return verdict == SMACK_TRANS_ALLOW;
+}
+
+static void freesnapshot(struct smack_epoch_node *node)
+{
+	snapshot_t *snap = (snapshot_t*)node;
+
+	if (snap->db)
+		munmap((void*)snap->db, snap->stamp.size);
+	else
+		free((void*)snap->trie);
+	free(snap->pairs);
+	free(snap);
+}
+
+// Build a snapshot of the rules of all blocks.
+static snapshot_t *buildsnapshot(const fileblock_t *blocks)
+{
+	const fileblock_t *b;
+	snapshot_t *snap;
+	trie_t trie = { NULL, 0, 0 };
+	size_t total = 0;
+	size_t i, j;
+	int denies = 0;
+
+	for (b = blocks; b; b = b->next)
+		total += b->rules.count;
+
+	snap = (snapshot_t*)calloc(1, sizeof(*snap));
+	if (!snap)
+		return NULL;
+	snap->size = 16;
+	while (snap->size < total * 2)
+		snap->size *= 2;
+	snap->pairs = (uint64_t*)calloc(snap->size, sizeof(*snap->pairs));
+	if (!snap->pairs) {
+		free(snap);
+		return NULL;
+	}
+
+	for (b = blocks; b; b = b->next) {
+		for (i = 0; i < b->rules.count; ++i) {
+			uint64_t key = b->rules.pairs[i];
+			for (j = pairslot(key & ~PAIR_DENY, snap->size); snap->pairs[j];
+			     j = (j+1) & (snap->size-1))
+			{
+				if ((snap->pairs[j] & ~PAIR_DENY) == (key & ~PAIR_DENY))
+					break;
+			}
+			if (!snap->pairs[j])
+				++snap->count;
+			// a deny rule wins
+			snap->pairs[j] |= key;
+		}
+	}
+
+	for (b = blocks; b; b = b->next) {
+		for (i = 0; i < b->patterns.count; ++i) {
+			uint64_t key = b->patterns.pairs[i];
+			int rc = trieadd(&trie, smack_labelname(pairsub(key)),
+			                 smack_labelname(pairobj(key)),
+			                 !!(key & PAIR_DENY));
+			if (rc < 0) {
+				free(trie.nodes);
+				free(snap->pairs);
+				free(snap);
+				return NULL;
+			}
+			snap->patterns += rc;
+			denies |= !!(key & PAIR_DENY);
+		}
+	}
+	snap->trie = trie.nodes;
+	snap->nodes = trie.count;
+
+	// settle the pairs denied by a pattern, so a lookup need not walk it
+	for (j = 0; denies && j < snap->size; ++j) {
+		uint64_t key = snap->pairs[j];
+		if (key && !(key & PAIR_DENY) &&
+		    smack_trieverdict(snap->trie, snap->nodes,
+		                      smack_labelname(pairsub(key)),
+		                      smack_labelname(pairobj(key))) == SMACK_TRANS_DENY)
+			snap->pairs[j] |= PAIR_DENY;
+	}
+	return snap;
+}
+
+// Called with the context's lock held.
+static void publish(struct smacktrans_ctx *ctx, snapshot_t *snap)
+{
+	snapshot_t *old;
+
+	old = __atomic_exchange_n(&ctx->snapshot, snap, __ATOMIC_ACQ_REL);
+	// after the snapshot, so a reader of the new generation sees it
+	__atomic_add_fetch(&ctx->generation, 1, __ATOMIC_RELEASE);
+	if (old)
+		smack_epoch_retire(&old->node, freesnapshot);
+}
+
+static void addpair(fileblock_t *b, const char *sub, const char *obj,
+                    int deny)
+{
+	smacklabel_id_t subid = smack_intern(sub);
+	smacklabel_id_t objid = smack_intern(obj);
+	pairlist_t *list = &b->rules;
+
+	if (strchr(sub, '*') || strchr(obj, '*'))
+		list = &b->patterns;
+	if (list->count == list->alloc) {
+		size_t alloc = list->alloc ? list->alloc * 2 : 64;
+		uint64_t *pairs = (uint64_t*)realloc(list->pairs, alloc * sizeof(*pairs));
+		if (!pairs)
+			subid = SMACK_LABEL_NONE;
+		else {
+			list->pairs = pairs;
+			list->alloc = alloc;
+		}
+	}
+	if (!subid || !objid) {
+		fprintf(stderr, "Out of memory, dropping transition %s -> %s\n",
+		        sub, obj);
+		return;
 	}
+	list->pairs[list->count++] = pairkey(subid, objid) | (deny ? PAIR_DENY : 0);
 }
 
-static void cacherule(const char *sub, const char *obj)
+// A '*' may only end a pattern.
+static int validpattern(const char *label)
 {
-	rule_t *ent = (rule_t*)malloc(sizeof(rule_t));
-	strncpy(ent->subject, sub, sizeof(ent->subject));
-	strncpy(ent->object, obj, sizeof(ent->object));
-	ent->next = rules;
-	rules = ent;
+	const char *star = strchr(label, '*');
+
+	return !star || !star[1];
 }
 
-static void readtransfile(const char *filename,
-                          const char *subject, const char *object,
-                          int *allowed, int *forbidden,
-                          int is_nondirfile, time_t now)
+static inline int tsafter(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec > b->tv_sec ||
+	       (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
+
+static int sameblock(const fileblock_t *b, const struct stat *st)
+{
+	return !b->racy &&
+	       b->dev == st->st_dev &&
+	       b->ino == st->st_ino &&
+	       b->size == st->st_size &&
+	       b->mtime.tv_sec == st->st_mtim.tv_sec &&
+	       b->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void freeblock(fileblock_t *b)
+{
+	free(b->path);
+	free(b->rules.pairs);
+	free(b->patterns.pairs);
+	free(b->errors);
+	free(b);
+}
+
+static void adderror(fileblock_t *b, unsigned long lineno)
+{
+	if (b->nerrors == b->erroralloc) {
+		size_t alloc = b->erroralloc ? b->erroralloc * 2 : 8;
+		unsigned long *errors = (unsigned long*)realloc(b->errors, alloc * sizeof(*errors));
+		if (!errors) {
+			// cannot wait for the others
+			fprintf(stderr, "Error in %s:%lu\n", b->path, lineno);
+			return;
+		}
+		b->errors = errors;
+		b->erroralloc = alloc;
+	}
+	b->errors[b->nerrors++] = lineno;
+}
+
+unsigned long smack_trans_parses;
+unsigned smack_trans_threads;
+
+/* (Re-)parse a file into its block.
+ * Returns -1 if the file cannot be read.
+ */
+static int readtransfile(fileblock_t *b)
 {
 	char *line = NULL;
 	size_t n = 0;
+	unsigned long lineno = 0;
 	FILE *fp;
+	struct stat st;
+	struct timespec now;
 	char linesub[SMACK_LONGLABEL];
 	char lineobj[SMACK_LONGLABEL];
-	char _filename[1024];
+	char linearrow[4];
 
-#ifdef SMACK_TRANSITION_FILE
-	if (is_nondirfile)
-		strncpy(_filename, SMACK_TRANSITION_FILE, sizeof(_filename));
-#endif
-#ifdef SMACK_TRANSITION_DIR
-#  ifdef SMACK_TRANSITION_FILE
-	else
-#   endif
-	{
-		strncpy(_filename, SMACK_TRANSITION_DIR, sizeof(_filename));
-		strncat(_filename, "/", sizeof(_filename));
-		strncat(_filename, filename, sizeof(_filename));
-	}
-#endif
-
-	fp = fopen(_filename, "r");
+	fp = fopen(b->path, "re");
 	if (!fp)
-		return;
+		return -1;
+	if (fstat(fileno(fp), &st) != 0) {
+		fclose(fp);
+		return -1;
+	}
 
-#ifdef SMACK_TRANSITION_FILE
-	if (is_nondirfile)
-		fc_file.readtime = now;
-#endif
-#ifdef SMACK_TRANSITION_DIR
-#  ifdef SMACK_TRANSITION_FILE
-	else
-#  endif
-		addcache(filename, now);
-#endif
+	// fingerprint what is actually read
+	b->dev = st.st_dev;
+	b->ino = st.st_ino;
+	b->size = st.st_size;
+	b->mtime = st.st_mtim;
+	/* A file written again within the timestamp granularity of its
+	 * file system would look unchanged, so a file which was modified
+	 * just now is read again next time. A time in the future, from a
+	 * skewed clock, is no reason to read it on every scan.
+	 */
+	clock_gettime(CLOCK_REALTIME, &now);
+	b->racy = !tsafter(&st.st_mtim, &now) && now.tv_sec - st.st_mtim.tv_sec < 2;
+	b->rules.count = 0;
+	b->patterns.count = 0;
+	b->nerrors = 0;
+	__atomic_add_fetch(&smack_trans_parses, 1, __ATOMIC_RELAXED);
 
 	while (getline(&line, &n, fp) != -1) {
 		size_t n = strspn(line, " \t\r\n\f");
+		++lineno;
 		// # are comments
 		if (line[n] == '#')
 			continue;
@@ -124,125 +579,784 @@ static void readtransfile(const char *filename,
 		// read the rule
 		if (sscanf(line,
 		           " %" SMACK_LONGLABEL_STR_minus1
-		           "[a-zA-Z0-9_-] -> %" SMACK_LONGLABEL_STR_minus1
-		           "[a-zA-Z0-0_-] ",
-		           linesub, lineobj) != 2)
+		           "[a-zA-Z0-9_.*-] %3[!->] %" SMACK_LONGLABEL_STR_minus1
+		           "[a-zA-Z0-9_.*-] ",
+		           linesub, linearrow, lineobj) != 3 ||
+		    (strcmp(linearrow, "->") && strcmp(linearrow, "!->")) ||
+		    !validpattern(linesub) || !validpattern(lineobj))
 		{
-			fprintf(stderr, "Error in %s\n", _filename);
+			adderror(b, lineno);
 			continue;
 		}
-		cacherule(linesub, lineobj);
-		if (!*allowed &&
-		    !strcmp(subject, linesub) &&
-		    !strcmp(object, lineobj))
-		{
-			*allowed = 1;
-		}
+		addpair(b, linesub, lineobj, linearrow[0] == '!');
 	}
 
+	free(line);
 	fclose(fp);
+	return 0;
 }
 
-static int checkcache(time_t now, int *allowed, int *forbidden)
+/* Check the block of one existing file, marking it to be parsed if
+ * the file is new or changed.
+ * Returns 1 if the rules changed, 0 if not.
+ */
+static int scanfile(struct smacktrans_ctx *ctx,
+                    const char *path, const struct stat *st)
 {
-	struct stat stbuf;
-	int rc;
-	int found;
-	int existed;
-	filecache_t *fi;
-
-#ifdef SMACK_TRANSITION_FILE
-	do {
-		existed = (fc_file.readtime != 0);
+	fileblock_t **pb, *b;
+	int isfile = ctx->file && !strcmp(path, ctx->file);
 
-		rc = stat(SMACK_TRANSITION_FILE, &stbuf);
-		found = (rc == 0);
+	for (b = ctx->blocks; b; b = b->next)
+		if (!strcmp(b->path, path))
+			break;
+	if (b && sameblock(b, st)) {
+		b->seen = 1;
+		return 0;
+	}
 
-		// if the state of existance changed: reload
-		if (existed != found) {
-			// reload
+	if (!b) {
+		b = (fileblock_t*)calloc(1, sizeof(*b));
+		if (!b || !(b->path = strdup(path))) {
+			free(b);
+			fprintf(stderr, "Out of memory, skipping %s\n", path);
 			return 0;
 		}
+		// keep the file order
+		pb = &ctx->blocks;
+		while (!isfile && *pb &&
+		       ((ctx->file && !strcmp((*pb)->path, ctx->file)) ||
+		        strcmp((*pb)->path, path) < 0))
+			pb = &(*pb)->next;
+		b->next = *pb;
+		*pb = b;
+	}
+	b->seen = 1;
+	b->pending = 1;
+	return 1;
+}
+
+typedef struct parsejob_s {
+	fileblock_t **blocks;
+	size_t        count;
+	size_t        next;  // the next block to take
+} parsejob_t;
+
+// Parse blocks until none are left.
+static void *parseworker(void *data)
+{
+	parsejob_t *job = (parsejob_t*)data;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count)
+		job->blocks[i]->failed = readtransfile(job->blocks[i]) != 0;
+	return NULL;
+}
+
+/* Parse the pending blocks on a few threads, each taking the next file
+ * when it is done with one, as the files differ in size.
+ */
+static void parseblocks(struct smacktrans_ctx *ctx)
+{
+	pthread_t tids[TRANS_MAXTHREADS];
+	fileblock_t *array[64];
+	parsejob_t job;
+	fileblock_t *b;
+	long threads;
+	int t, started;
+
+	memset(&job, 0, sizeof(job));
+	for (b = ctx->blocks; b; b = b->next)
+		job.count += b->pending;
+	if (!job.count)
+		return;
+	job.blocks = job.count <= 64 ? array
+	           : (fileblock_t**)malloc(job.count * sizeof(*job.blocks));
+	if (!job.blocks) {
+		for (b = ctx->blocks; b; b = b->next)
+			if (b->pending)
+				b->failed = readtransfile(b) != 0;
+		return;
+	}
+	job.count = 0;
+	for (b = ctx->blocks; b; b = b->next)
+		if (b->pending)
+			job.blocks[job.count++] = b;
+
+	threads = smack_trans_threads;
+	if (!threads)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > TRANS_MAXTHREADS)
+		threads = TRANS_MAXTHREADS;
+	if (threads > (long)job.count)
+		threads = job.count;
 
-		// if it doesn't exist: ignore
-		if (!existed)
+	// the calling thread works too
+	for (started = 1; started < threads; ++started)
+		if (pthread_create(&tids[started], NULL, parseworker, &job) != 0)
 			break;
+	parseworker(&job);
+	for (t = 1; t < started; ++t)
+		pthread_join(tids[t], NULL);
 
-		// otherwise check
-		if (stbuf.st_mtime >= fc_file.readtime)
-			return 0; // reload
-	} while (0);
-#endif
+	if (job.blocks != array)
+		free(job.blocks);
+}
+
+/* Compare the files with their blocks, parse those which are new or
+ * changed, and drop those which disappeared.
+ * Returns 1 if the rules changed, 0 if not.
+ */
+static int scanblocks(struct smacktrans_ctx *ctx)
+{
+	fileblock_t **pb, *b;
+	struct stat st;
+	int dirty = 0;
+
+	for (b = ctx->blocks; b; b = b->next)
+		b->seen = 0;
+
+	// first check the file
+	if (ctx->file && stat(ctx->file, &st) == 0 && S_ISREG(st.st_mode))
+		dirty |= scanfile(ctx, ctx->file, &st);
 
-#ifdef SMACK_TRANSITION_DIR
 	// then transition.d/* non-recursively
 	do {
 		DIR           *dir;
 		struct dirent *entry;
+		char           path[1024];
 
-		dir = opendir(SMACK_TRANSITION_DIR);
+		if (!ctx->dir)
+			break;
+		dir = opendir(ctx->dir);
 		if (!dir)
 			break;
 
 		for (entry = readdir(dir); entry; entry = readdir(dir))
 		{
-			// only read regular files
-			if (entry->d_type != DT_REG)
-				continue;
-
 			// check for some validity (eg. ignore files starting with a dot)
 			if (!VALID_TRANSITION_D_ENTRY(entry->d_name))
 				continue;
 
-			// find it in cache:
-			for (fi = fc_dir; fi; fi = fi->next)
-			{
-				if (!strcmp(fi->filename, entry->d_name))
-					break;
-			}
-			if (!fi) {
-				// a new file appeared
-				// reload
-				closedir(dir);
-				return 0;
-			}
-			// check the file:
-			rc = stat(fi->filename, &stbuf);
-			if (!rc) {
-				// stat failed
-				// reload
-				closedir(dir);
-				return 0;
-			}
-			if (stbuf.st_mtime >= fi->readtime) {
-				// changed, reload
-				closedir(dir);
-				return 0;
-			}
-			// remember that we checkd this file
-			fi->checktime = now;
+			// only read regular files
+			if (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN)
+				continue;
+			if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 ||
+			    !S_ISREG(st.st_mode))
+				continue;
+
+			if ((size_t)snprintf(path, sizeof(path), "%s/%s",
+			                     ctx->dir, entry->d_name)
+			    >= sizeof(path))
+				continue;
+			dirty |= scanfile(ctx, path, &st);
 		}
 
 		closedir(dir);
 	} while(0);
 
-	// look for any files we haven't checked:
-	for (fi = fc_dir; fi; fi = fi->next)
-	{
-		if (fi->checktime != now)
-			return 0;
+	parseblocks(ctx);
+
+	// drop the files which are gone or unreadable, in file order
+	for (pb = &ctx->blocks; (b = *pb); ) {
+		if (b->pending) {
+			size_t i;
+			for (i = 0; !b->failed && i < b->nerrors; ++i)
+				fprintf(stderr, "Error in %s:%lu\n", b->path, b->errors[i]);
+			b->pending = 0;
+		}
+		if (b->seen && !b->failed) {
+			pb = &b->next;
+			continue;
+		}
+		*pb = b->next;
+		freeblock(b);
+		dirty = 1;
 	}
-#endif
+	return dirty;
+}
+
+static void stampof(dbstamp_t *stamp, const struct stat *st)
+{
+	stamp->dev = st->st_dev;
+	stamp->ino = st->st_ino;
+	stamp->size = st->st_size;
+	stamp->mtime = st->st_mtim;
+}
+
+static int samestamp(const dbstamp_t *a, const dbstamp_t *b)
+{
+	return a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+	       a->mtime.tv_sec == b->mtime.tv_sec &&
+	       a->mtime.tv_nsec == b->mtime.tv_nsec;
+}
+
+/* Check if none of the rule files was modified at or after @mtime.
+ * The directory's own time covers files which were added or removed.
+ */
+static int sourcesbefore(const struct smacktrans_ctx *ctx,
+                         const struct timespec *mtime)
+{
+	struct dirent *entry;
+	struct stat st;
+	DIR *dir;
+	int rc = 1;
+
+	if (ctx->file && stat(ctx->file, &st) == 0 && !tsafter(mtime, &st.st_mtim))
+		return 0;
+	if (!ctx->dir || !(dir = opendir(ctx->dir)))
+		return 1;
+	if (fstat(dirfd(dir), &st) != 0 || !tsafter(mtime, &st.st_mtim))
+		rc = 0;
+	while (rc && (entry = readdir(dir))) {
+		if (!VALID_TRANSITION_D_ENTRY(entry->d_name))
+			continue;
+		if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+		    S_ISREG(st.st_mode) && !tsafter(mtime, &st.st_mtim))
+			rc = 0;
+	}
+	closedir(dir);
+	return rc;
+}
+
+static pthread_once_t crconce = PTHREAD_ONCE_INIT;
+static uint32_t crctable[256];
+
+static void crcinit(void)
+{
+	uint32_t c;
+	int i, k;
+
+	for (i = 0; i < 256; ++i) {
+		c = i;
+		for (k = 0; k < 8; ++k)
+			c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		crctable[i] = c;
+	}
+}
+
+// Continue the CRC-32 @crc, which starts out as 0, over more data.
+static uint32_t crc32(uint32_t crc, const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char*)data;
+	uint32_t c = crc ^ 0xffffffff;
+
+	pthread_once(&crconce, crcinit);
+	while (len--)
+		c = crctable[(c ^ *p++) & 0xff] ^ (c >> 8);
+	return c ^ 0xffffffff;
+}
+
+/* Check that a mapped database is complete and consistent, so lookups
+ * can trust its offsets.
+ */
+static int verifydb(const transdb_header_t *db, size_t size)
+{
+	const transdb_slot_t *slots;
+	const trienode_t *trie;
+	const char *labels;
+	size_t i, used = 0;
+
+	if (size < sizeof(*db) ||
+	    memcmp(db->magic, TRANSDB_MAGIC, sizeof(db->magic)) != 0 ||
+	    db->version != TRANSDB_VERSION ||
+	    db->byteorder != TRANSDB_BYTEORDER ||
+	    db->size != size ||
+	    !db->slots || (db->slots & (db->slots-1)) ||
+	    db->index != sizeof(*db) ||
+	    db->trie != db->index + (uint64_t)db->slots * sizeof(*slots) ||
+	    db->labels != db->trie + (uint64_t)db->nodes * sizeof(*trie) ||
+	    !db->labelsize || db->labelsize > UINT32_MAX ||
+	    db->labels + db->labelsize != size)
+		return -1;
+	if (crc32(0, db + 1, size - sizeof(*db)) != db->checksum)
+		return -1;
+
+	slots = dbslots(db);
+	labels = dblabels(db);
+	if (labels[0] || labels[db->labelsize-1])
+		return -1;
+	for (i = 0; i < db->slots; ++i) {
+		if (!slots[i].subject)
+			continue;
+		if (slots[i].subject >= db->labelsize || !slots[i].object ||
+		    slots[i].object >= db->labelsize || (slots[i].flags & ~TRANSDB_DENY))
+			return -1;
+		++used;
+	}
+	// a lookup needs a free slot to stop at
+	if (used != db->rules || used >= db->slots)
+		return -1;
+
+	// links only lead forward, so walks end
+	trie = dbtrie(db);
+	for (i = 0; i < db->nodes; ++i) {
+		if ((trie[i].child && (trie[i].child <= i || trie[i].child >= db->nodes)) ||
+		    (trie[i].sibling && (trie[i].sibling <= i || trie[i].sibling >= db->nodes)) ||
+		    (trie[i].exact && (trie[i].exact <= i || trie[i].exact >= db->nodes)) ||
+		    (trie[i].prefix && (trie[i].prefix <= i || trie[i].prefix >= db->nodes)))
+			return -1;
+	}
+	return 0;
+}
+
+/* Use the compiled database if it is newer than the rule files.
+ * Returns 1 if its snapshot is current, 0 to use the files.
+ */
+static int scandb(struct smacktrans_ctx *ctx)
+{
+	snapshot_t *snap = ctx->snapshot;
+	dbstamp_t stamp;
+	struct stat st;
+	void *map;
+	int fd;
+
+	if (stat(ctx->db, &st) != 0 || !S_ISREG(st.st_mode) ||
+	    !sourcesbefore(ctx, &st.st_mtim))
+		return 0;
+	stampof(&stamp, &st);
+	if (snap && snap->db && samestamp(&snap->stamp, &stamp))
+		return 1;
+	if (samestamp(&ctx->baddb, &stamp))
+		return 0;
+
+	fd = open(ctx->db, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &st) != 0 || !st.st_size) {
+		close(fd);
+		return 0;
+	}
+	stampof(&stamp, &st);
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return 0;
+	if (verifydb((const transdb_header_t*)map, st.st_size) != 0) {
+		fprintf(stderr, "Invalid transition database %s, using the rule files\n",
+		        ctx->db);
+		munmap(map, st.st_size);
+		ctx->baddb = stamp;
+		return 0;
+	}
+
+	snap = (snapshot_t*)calloc(1, sizeof(*snap));
+	if (!snap) {
+		munmap(map, st.st_size);
+		return 0;
+	}
+	snap->db = (const transdb_header_t*)map;
+	snap->stamp = stamp;
+	snap->trie = dbtrie(snap->db);
+	snap->nodes = snap->db->nodes;
+	ctx->stale = 0;
+	publish(ctx, snap);
 	return 1;
 }
 
-int smackchecktrans(const char *subject, const char *object)
+/* Bring the snapshot up to date with the database or the files, and
+ * publish a new one if anything changed. Called with the context's lock
+ * held.
+ */
+static void scan(struct smacktrans_ctx *ctx)
+{
+	snapshot_t *snap;
+	int dirty;
+
+	if (ctx->db && scandb(ctx))
+		return;
+	dirty = scanblocks(ctx);
+	// a snapshot of the database is replaced by the files' rules
+	if (!dirty && !ctx->stale && ctx->snapshot && !ctx->snapshot->db)
+		return;
+	snap = buildsnapshot(ctx->blocks);
+	if (!snap) {
+		// keep the old rules, and try again next time
+		fprintf(stderr, "Out of memory, transition rules not reloaded\n");
+		ctx->stale = 1;
+		return;
+	}
+	ctx->stale = 0;
+	publish(ctx, snap);
+}
+
+/* Change detection through inotify.
+ * A single inotify instance serves all contexts: the parent
+ * directories are watched for the transition file, directory and
+ * database being created, removed or renamed over, and the directory itself for its
+ * entries. Events only set the changed flag of the contexts they
+ * concern, so checking an unchanged configuration costs no system
+ * calls. Watching is up to the application: it either polls the
+ * descriptor itself, or has a thread wait for events. Until it asks
+ * for either, or where nothing can be watched, every check stats the
+ * files instead, which is cheaper for a process checking only once.
+ */
+#define WATCH_DIRMASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+                       IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+static pthread_mutex_t watchlock = PTHREAD_MUTEX_INITIALIZER;
+static int watchstate;  // 0 before the first try, 1 watching, -1 unavailable
+static int watchfd = -1;
+static int watchclaimed; // the application reads watchfd
+static int watchwanted;  // the application asked for the watcher thread
+static int watchthread;
+static struct smacktrans_ctx *contexts; // protected by watchlock
+
+static const char *basename_of(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+static int watchparent(const char *path)
+{
+	char parent[1024];
+	const char *base = basename_of(path);
+
+	if (base == path || (size_t)(base - path) >= sizeof(parent))
+		return -1;
+	memcpy(parent, path, base - path);
+	parent[base - path == 1 ? 1 : base - path - 1] = 0;
+	return inotify_add_watch(watchfd, parent, WATCH_DIRMASK | IN_ONLYDIR);
+}
+
+/* (Re-)add the watches of a context, the directory may have appeared
+ * since. Called with watchlock held.
+ * Returns -1 if the configuration cannot be watched at all.
+ */
+static int addwatches(struct smacktrans_ctx *ctx)
+{
+	if (ctx->file) {
+		ctx->wd_fileparent = watchparent(ctx->file);
+		if (ctx->wd_fileparent < 0)
+			return -1;
+	}
+	if (ctx->dir) {
+		ctx->wd_dirparent = watchparent(ctx->dir);
+		if (ctx->wd_dirparent < 0)
+			return -1;
+		// it is fine if the directory does not exist yet
+		ctx->wd_dir = inotify_add_watch(watchfd, ctx->dir,
+		                                WATCH_DIRMASK | IN_ONLYDIR);
+	}
+	if (ctx->db) {
+		ctx->wd_dbparent = watchparent(ctx->db);
+		if (ctx->wd_dbparent < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int relevant(const struct smacktrans_ctx *ctx,
+                    const struct inotify_event *ev)
+{
+	if (ev->mask & IN_Q_OVERFLOW)
+		return 1;
+	if (ctx->dir && ev->wd == ctx->wd_dir)
+		return !ev->len || VALID_TRANSITION_D_ENTRY(ev->name) ||
+		       (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED));
+	if (ctx->dir && ev->wd == ctx->wd_dirparent &&
+	    ((ev->mask & IN_IGNORED) ||
+	     (ev->len && !strcmp(ev->name, basename_of(ctx->dir)))))
+		return 1;
+	if (ctx->file && ev->wd == ctx->wd_fileparent &&
+	    ((ev->mask & IN_IGNORED) ||
+	     (ev->len && !strcmp(ev->name, basename_of(ctx->file)))))
+		return 1;
+	if (ctx->db && ev->wd == ctx->wd_dbparent &&
+	    ((ev->mask & IN_IGNORED) ||
+	     (ev->len && !strcmp(ev->name, basename_of(ctx->db)))))
+		return 1;
+	return 0;
+}
+
+/* Consume the pending events.
+ * Returns 1 if a configuration changed, 0 if not, -1 on error.
+ */
+static int drainwatch(void)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct smacktrans_ctx *ctx;
+	int found = 0;
+	ssize_t len;
+	char *p;
+
+	for (;;) {
+		len = read(watchfd, buf, sizeof(buf));
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			return -1;
+		}
+		pthread_mutex_lock(&watchlock);
+		for (p = buf; p < buf + len; ) {
+			const struct inotify_event *ev = (const struct inotify_event*)p;
+			for (ctx = contexts; ctx; ctx = ctx->next) {
+				if (ctx->watched > 0 && relevant(ctx, ev)) {
+					__atomic_store_n(&ctx->changed, 1, __ATOMIC_RELEASE);
+					found = 1;
+				}
+			}
+			p += sizeof(*ev) + ev->len;
+		}
+		pthread_mutex_unlock(&watchlock);
+	}
+	return found;
+}
+
+static void *watcher(void *unused)
+{
+	struct smacktrans_ctx *ctx;
+	struct pollfd pfd;
+
+	(void)unused;
+	pfd.fd = watchfd;
+	pfd.events = POLLIN;
+	for (;;) {
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			break;
+		if (drainwatch() < 0)
+			break;
+	}
+	// go back to checking the files on every call
+	pthread_mutex_lock(&watchlock);
+	__atomic_store_n(&watchstate, -1, __ATOMIC_RELEASE);
+	for (ctx = contexts; ctx; ctx = ctx->next)
+		__atomic_store_n(&ctx->changed, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&watchlock);
+	return NULL;
+}
+
+static int startwatcher(void)
+{
+	pthread_attr_t attr;
+	pthread_t tid;
+	sigset_t all, old;
+	int rc;
+
+	// the thread must not take signals meant for the application
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	rc = pthread_create(&tid, &attr, watcher, NULL);
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return rc == 0 ? 0 : -1;
+}
+
+// The watcher thread does not survive a fork, the inotify descriptor
+// would be shared with the parent, and locks may be held by threads
+// which are gone.
+static void watch_atfork_child(void)
+{
+	struct smacktrans_ctx *ctx;
+
+	if (watchfd >= 0)
+		close(watchfd);
+	watchfd = -1;
+	watchstate = 0;
+	watchclaimed = 0;
+	watchthread = 0;
+	for (ctx = contexts; ctx; ctx = ctx->next) {
+		ctx->watched = 0;
+		ctx->changed = 1;
+		pthread_mutex_init(&ctx->lock, NULL);
+	}
+	pthread_mutex_init(&watchlock, NULL);
+}
+
+static void watch_atfork_init(void)
+{
+	pthread_atfork(NULL, NULL, watch_atfork_child);
+}
+
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+/* Set up the inotify instance once the application asked for it.
+ * Returns 1 if changes are watched, 0 if the files have to be checked.
+ */
+static int watching(int claim)
+{
+	int state = __atomic_load_n(&watchstate, __ATOMIC_ACQUIRE);
+
+	if (state && !claim)
+		return state > 0;
+	if (!claim && !__atomic_load_n(&watchwanted, __ATOMIC_ACQUIRE))
+		return 0;
+
+	pthread_mutex_lock(&watchlock);
+	if (claim)
+		watchclaimed = 1;
+	state = watchstate;
+	if (!state) {
+		watchfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		state = watchfd >= 0 ? 1 : -1;
+	}
+	if (state > 0 && !watchclaimed && !watchthread) {
+		if (startwatcher() == 0)
+			watchthread = 1;
+		else
+			state = -1;
+	}
+	__atomic_store_n(&watchstate, state, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&watchlock);
+	return state > 0;
+}
+
+/* Set up the watches of a context on its first use.
+ * Returns 1 if its changes are watched.
+ */
+static int ctxwatching(struct smacktrans_ctx *ctx)
+{
+	int state = __atomic_load_n(&ctx->watched, __ATOMIC_ACQUIRE);
+
+	if (state)
+		return state > 0 && __atomic_load_n(&watchstate, __ATOMIC_ACQUIRE) > 0;
+
+	// the context may still be watched later
+	if (!watching(0))
+		return 0;
+	state = 1;
+	pthread_mutex_lock(&watchlock);
+	if (!ctx->watched) {
+		if (addwatches(ctx) != 0)
+			state = -1;
+		__atomic_store_n(&ctx->watched, state, __ATOMIC_RELEASE);
+	}
+	state = ctx->watched;
+	pthread_mutex_unlock(&watchlock);
+	return state > 0;
+}
+
+// Called with the context's lock held.
+static void reload(struct smacktrans_ctx *ctx, int force)
+{
+	if (ctxwatching(ctx)) {
+		if (!__atomic_exchange_n(&ctx->changed, 0, __ATOMIC_ACQ_REL) &&
+		    !force && ctx->snapshot)
+			return;
+		// changes from here on are seen by the next check
+		pthread_mutex_lock(&watchlock);
+		if (watchfd >= 0)
+			addwatches(ctx);
+		pthread_mutex_unlock(&watchlock);
+	}
+	scan(ctx);
+}
+
+// Make sure the rules reflect the configuration files.
+static void refresh(struct smacktrans_ctx *ctx)
+{
+	// until the first snapshot is published, the rules are not loaded
+	// even though the changed flag may already be consumed
+	if (ctxwatching(ctx) &&
+	    !__atomic_load_n(&ctx->changed, __ATOMIC_ACQUIRE) &&
+	    __atomic_load_n(&ctx->snapshot, __ATOMIC_ACQUIRE))
+		return;
+
+	// one thread reloads, the others go on with the current rules
+	if (pthread_mutex_trylock(&ctx->lock) != 0) {
+		if (__atomic_load_n(&ctx->snapshot, __ATOMIC_ACQUIRE))
+			return;
+		pthread_mutex_lock(&ctx->lock);
+	}
+	reload(ctx, 0);
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+// The labels are given by name or as interned labels, see snaphasrule().
+static int lookup(struct smacktrans_ctx *ctx,
+                  const char *sub, const char *obj,
+                  smacklabel_id_t subid, smacklabel_id_t objid)
+{
+	int rc;
+
+	if (smack_epoch_enter() != 0) {
+		// without a reader record, keep reloads away instead
+		pthread_mutex_lock(&ctx->lock);
+		rc = snaphasrule(__atomic_load_n(&ctx->snapshot, __ATOMIC_ACQUIRE),
+		                 sub, obj, subid, objid);
+		pthread_mutex_unlock(&ctx->lock);
+		return rc;
+	}
+	rc = snaphasrule(__atomic_load_n(&ctx->snapshot, __ATOMIC_ACQUIRE),
+	                 sub, obj, subid, objid);
+	smack_epoch_leave();
+	return rc;
+}
+
+static void ctxinit(struct smacktrans_ctx *ctx,
+                    const char *file, const char *dir, const char *db)
+{
+	ctx->file = file;
+	ctx->dir = dir;
+	ctx->db = db;
+	memset(&ctx->baddb, 0, sizeof(ctx->baddb));
+	ctx->snapshot = NULL;
+	ctx->generation = 0;
+	pthread_mutex_init(&ctx->lock, NULL);
+	ctx->blocks = NULL;
+	ctx->stale = 0;
+	ctx->changed = 1;
+	ctx->watched = 0;
+	ctx->wd_fileparent = -1;
+	ctx->wd_dirparent = -1;
+	ctx->wd_dir = -1;
+	ctx->wd_dbparent = -1;
+
+	pthread_once(&atfork_once, watch_atfork_init);
+	pthread_mutex_lock(&watchlock);
+	ctx->next = contexts;
+	contexts = ctx;
+	pthread_mutex_unlock(&watchlock);
+}
+
+static int checkpath(const char *path)
+{
+	return !path || !*path || path[0] == '/';
+}
+
+struct smacktrans_ctx *smacktrans_open(const char *file, const char *dir)
 {
-	int allowed = 0;
-	int forbidden = 0;
+	struct smacktrans_ctx *ctx;
+	size_t flen, dlen;
+	char *paths;
+
+#ifdef SMACK_TRANSITION_FILE
+	if (!file)
+		file = SMACK_TRANSITION_FILE;
+#endif
+#ifdef SMACK_TRANSITION_DIR
+	if (!dir)
+		dir = SMACK_TRANSITION_DIR;
+#endif
+	if (!checkpath(file) || !checkpath(dir)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	flen = file && *file ? strlen(file) + 1 : 0;
+	dlen = dir && *dir ? strlen(dir) + 1 : 0;
 
-	time_t now = time(NULL);
+	// the paths are stored behind the context
+	ctx = (struct smacktrans_ctx*)malloc(sizeof(*ctx) + flen + dlen);
+	if (!ctx) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	paths = (char*)(ctx + 1);
+	if (flen)
+		memcpy(paths, file, flen);
+	if (dlen)
+		memcpy(paths + flen, dir, dlen);
+	ctxinit(ctx, flen ? paths : NULL, dlen ? paths + flen : NULL, NULL);
+	return ctx;
+}
 
+int smacktrans_check(struct smacktrans_ctx *ctx,
+                     const char *subject, const char *object)
+{
 	if (!subject != !object) // one of them is NULL
 		return 0;
 	if (!subject) // both are NULL (due to the above)
@@ -250,52 +1364,443 @@ int smackchecktrans(const char *subject, const char *object)
 	if (!strcmp(subject, object)) // both the same
 		return 1;
 
-#ifdef SMACK_TRANSITION_DIR
-	if (SMACK_TRANSITION_DIR[0] != '/') {
-		fprintf(stderr, "SMACK_TRANSITION_DIR is not an absolute path. Denying ALL transitions!\n");
-		return 0;
+	refresh(ctx);
+	return lookup(ctx, subject, object, SMACK_LABEL_NONE, SMACK_LABEL_NONE);
+}
+
+int smacktrans_reload(struct smacktrans_ctx *ctx)
+{
+	int stale;
+
+	pthread_mutex_lock(&ctx->lock);
+	reload(ctx, 1);
+	stale = ctx->stale;
+	pthread_mutex_unlock(&ctx->lock);
+	if (stale) {
+		errno = ENOMEM;
+		return -1;
 	}
+	return 0;
+}
+
+void smacktrans_close(struct smacktrans_ctx *ctx)
+{
+	struct smacktrans_ctx **pc;
+	fileblock_t *b;
+
+	if (!ctx)
+		return;
+
+	pthread_mutex_lock(&watchlock);
+	for (pc = &contexts; *pc; pc = &(*pc)->next) {
+		if (*pc == ctx) {
+			*pc = ctx->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&watchlock);
+
+	while ((b = ctx->blocks)) {
+		ctx->blocks = b->next;
+		freeblock(b);
+	}
+	if (ctx->snapshot)
+		smack_epoch_retire(&ctx->snapshot->node, freesnapshot);
+	pthread_mutex_destroy(&ctx->lock);
+	free(ctx);
+}
+
+/* The labels of a database being written: an open addressing table of
+ * label IDs with their offsets beside them.
+ */
+typedef struct labelmap_s {
+	smacklabel_id_t *ids;
+	uint32_t        *offsets;
+	size_t           size;
+	char            *strings;
+	size_t           length;
+} labelmap_t;
+
+static uint32_t labeloffset(labelmap_t *m, smacklabel_id_t id)
+{
+	size_t i;
+
+	for (i = id & (m->size-1); m->ids[i]; i = (i+1) & (m->size-1))
+		if (m->ids[i] == id)
+			return m->offsets[i];
+	m->ids[i] = id;
+	m->offsets[i] = (uint32_t)m->length;
+	memcpy(m->strings + m->length, smack_labelname(id), smack_labellen(id) + 1);
+	m->length += smack_labellen(id) + 1;
+	return m->offsets[i];
+}
+
+static int writeall(int fd, const void *data, size_t len)
+{
+	const char *p = (const char*)data;
+	ssize_t rc;
+
+	while (len) {
+		rc = write(fd, p, len);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += rc;
+		len -= rc;
+	}
+	return 0;
+}
+
+/* Write the rules of a snapshot to a new file which then replaces the
+ * database, so a reader maps either the old or the new one.
+ */
+static int writedb(const snapshot_t *snap, const char *path)
+{
+	transdb_header_t header;
+	transdb_slot_t *slots;
+	labelmap_t m;
+	char *tmp;
+	size_t nslots, i, j, maxlen = 1;
+	int fd, eno;
+
+	// at most two new labels per rule
+	m.size = 16;
+	while (m.size < snap->count * 4)
+		m.size *= 2;
+	nslots = 16;
+	while (nslots < snap->count * 2)
+		nslots *= 2;
+	for (i = 0; i < snap->size; ++i)
+		if (snap->pairs[i])
+			maxlen += smack_labellen(pairsub(snap->pairs[i])) + 1 +
+			          smack_labellen(pairobj(snap->pairs[i])) + 1;
+
+	m.ids = (smacklabel_id_t*)calloc(m.size, sizeof(*m.ids));
+	m.offsets = (uint32_t*)malloc(m.size * sizeof(*m.offsets));
+	m.strings = (char*)malloc(maxlen);
+	slots = (transdb_slot_t*)calloc(nslots, sizeof(*slots));
+	tmp = (char*)malloc(strlen(path) + sizeof(".XXXXXX"));
+	if (!m.ids || !m.offsets || !m.strings || !slots || !tmp ||
+	    maxlen > UINT32_MAX)
+	{
+		eno = maxlen > UINT32_MAX ? EFBIG : ENOMEM;
+		fd = -1;
+		goto out;
+	}
+	m.strings[0] = 0;
+	m.length = 1;
+
+	for (i = 0; i < snap->size; ++i) {
+		smacklabel_id_t sub = pairsub(snap->pairs[i]);
+		smacklabel_id_t obj = pairobj(snap->pairs[i]);
+		uint32_t hash;
+
+		if (!snap->pairs[i])
+			continue;
+		hash = smack_cache_pairhash(smack_labelname(sub), smack_labellen(sub),
+		                            smack_labelname(obj), smack_labellen(obj));
+		for (j = hash & (nslots-1); slots[j].subject; j = (j+1) & (nslots-1))
+			;
+		slots[j].hash = hash;
+		slots[j].subject = labeloffset(&m, sub);
+		slots[j].object = labeloffset(&m, obj);
+		slots[j].flags = snap->pairs[i] & PAIR_DENY ? TRANSDB_DENY : 0;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRANSDB_MAGIC, sizeof(header.magic));
+	header.version = TRANSDB_VERSION;
+	header.byteorder = TRANSDB_BYTEORDER;
+	header.rules = (uint32_t)snap->count;
+	header.slots = (uint32_t)nslots;
+	header.nodes = (uint32_t)snap->nodes;
+	header.index = sizeof(header);
+	header.trie = header.index + nslots * sizeof(*slots);
+	header.labels = header.trie + snap->nodes * sizeof(*snap->trie);
+	header.labelsize = m.length;
+	header.size = header.labels + header.labelsize;
+	header.checksum = crc32(0, slots, nslots * sizeof(*slots));
+	header.checksum = crc32(header.checksum, snap->trie,
+	                        snap->nodes * sizeof(*snap->trie));
+	header.checksum = crc32(header.checksum, m.strings, m.length);
+
+	sprintf(tmp, "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		eno = errno;
+		goto out;
+	}
+	if (fchmod(fd, 0644) != 0 ||
+	    writeall(fd, &header, sizeof(header)) != 0 ||
+	    writeall(fd, slots, nslots * sizeof(*slots)) != 0 ||
+	    writeall(fd, snap->trie, snap->nodes * sizeof(*snap->trie)) != 0 ||
+	    writeall(fd, m.strings, m.length) != 0 ||
+	    fsync(fd) != 0 ||
+	    rename(tmp, path) != 0)
+	{
+		eno = errno;
+		unlink(tmp);
+		close(fd);
+		fd = -1;
+		goto out;
+	}
+	close(fd);
+	eno = 0;
+
+out:
+	free(m.ids);
+	free(m.offsets);
+	free(m.strings);
+	free(slots);
+	free(tmp);
+	errno = eno;
+	return eno ? -1 : 0;
+}
+
+int smacktrans_compile(const char *file, const char *dir, const char *db)
+{
+	return smacktrans_compile2(file, dir, db, 0);
+}
+
+int smacktrans_compile2(const char *file, const char *dir, const char *db,
+                        int flags)
+{
+	struct smacktrans_ctx ctx;
+	snapshot_t *snap;
+	fileblock_t *b;
+	size_t nerrors = 0;
+	int rc;
+
+#ifdef SMACK_TRANSITION_FILE
+	if (!file)
+		file = SMACK_TRANSITION_FILE;
+#endif
+#ifdef SMACK_TRANSITION_DIR
+	if (!dir)
+		dir = SMACK_TRANSITION_DIR;
 #endif
+#ifdef SMACK_TRANSITION_DB
+	if (!db)
+		db = SMACK_TRANSITION_DB;
+#endif
+	if (!checkpath(file) || !checkpath(dir) || !db || !*db) {
+		errno = EINVAL;
+		return -1;
+	}
 
-	if (checkcache(now, &allowed, &forbidden)) {
-		// no need to reload
-		return forbidden ? 0 : allowed;
+	// a context of its own, which is neither watched nor published
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.file = file && *file ? file : NULL;
+	ctx.dir = dir && *dir ? dir : NULL;
+	scanblocks(&ctx);
+	for (b = ctx.blocks; b; b = b->next)
+		nerrors += b->nerrors;
+	// rules with syntax errors would silently be missing from the database
+	snap = nerrors && !(flags & SMACK_TRANS_FORCE) ? NULL
+	     : buildsnapshot(ctx.blocks);
+	while ((b = ctx.blocks)) {
+		ctx.blocks = b->next;
+		freeblock(b);
+	}
+	if (nerrors && !(flags & SMACK_TRANS_FORCE)) {
+		errno = EBADMSG;
+		return -1;
+	}
+	if (!snap) {
+		errno = ENOMEM;
+		return -1;
 	}
 
-	clearcache();
+	rc = writedb(snap, db);
+	if (rc == 0)
+		rc = (int)(snap->count + snap->patterns);
+	freesnapshot(&snap->node);
+	return rc;
+}
+
+/* The context behind smackchecktrans(). */
+static struct smacktrans_ctx defaultctx;
+static pthread_once_t defaultonce = PTHREAD_ONCE_INIT;
+
+static void defaultinit(void)
+{
+	const char *file = NULL;
+	const char *dir = NULL;
+	const char *db = NULL;
 
 #ifdef SMACK_TRANSITION_FILE
-	// first check the file
-	readtransfile(SMACK_TRANSITION_FILE, subject, object, &allowed, &forbidden, 1, now);
+	file = SMACK_TRANSITION_FILE;
+#endif
+#ifdef SMACK_TRANSITION_DIR
+	dir = SMACK_TRANSITION_DIR;
+#endif
+#ifdef SMACK_TRANSITION_DB
+	db = SMACK_TRANSITION_DB;
 #endif
+	ctxinit(&defaultctx, file, dir, db);
+}
 
+static struct smacktrans_ctx *getdefault(void)
+{
 #ifdef SMACK_TRANSITION_DIR
-	// then transition.d/* non-recursively
-	do {
-		DIR           *dir;
-		struct dirent *entry;
+	if (SMACK_TRANSITION_DIR[0] != '/') {
+		fprintf(stderr, "SMACK_TRANSITION_DIR is not an absolute path. Denying ALL transitions!\n");
+		return NULL;
+	}
+#endif
+	pthread_once(&defaultonce, defaultinit);
+	return &defaultctx;
+}
 
-		dir = opendir(SMACK_TRANSITION_DIR);
-		if (!dir)
-			break;
+int smackconfig_watch(void)
+{
+	__atomic_store_n(&watchwanted, 1, __ATOMIC_RELEASE);
+	if (!getdefault() || !watching(0) || !ctxwatching(&defaultctx)) {
+		errno = ENOSYS;
+		return -1;
+	}
+	return 0;
+}
 
-		for (entry = readdir(dir); entry; entry = readdir(dir))
-		{
-			// only read regular files
-			if (entry->d_type != DT_REG)
-				continue;
+int smackconfig_watch_fd(void)
+{
+	if (!getdefault() || !watching(1) || !ctxwatching(&defaultctx)) {
+		errno = ENOSYS;
+		return -1;
+	}
+	return watchfd;
+}
 
-			// check for some validity (eg. ignore files starting with a dot)
-			if (!VALID_TRANSITION_D_ENTRY(entry->d_name))
-				continue;
+int smackconfig_process(void)
+{
+	int rc;
+
+	if (!getdefault() || !ctxwatching(&defaultctx)) {
+		errno = ENOSYS;
+		return -1;
+	}
+	rc = drainwatch();
+	if (rc > 0)
+		refresh(&defaultctx);
+	return rc;
+}
 
-			// read
-			readtransfile(entry->d_name, subject, object, &allowed, &forbidden, 0, now);
+int smackchecktrans(const char *subject, const char *object)
+{
+	struct smacktrans_ctx *ctx = getdefault();
+
+	if (!ctx)
+		return 0;
+	return smacktrans_check(ctx, subject, object);
+}
+
+int smackchecktrans_id(smacklabel_id_t subject, smacklabel_id_t object)
+{
+	struct smacktrans_ctx *ctx;
+
+	if (subject == object)
+		return subject != SMACK_LABEL_NONE;
+	if (!subject || !object || !(ctx = getdefault()))
+		return 0;
+
+	refresh(ctx);
+	return lookup(ctx, NULL, NULL, subject, object);
+}
+
+struct smacktrans_ctx *smack_trans_default(void)
+{
+	return getdefault();
+}
+
+unsigned long smack_trans_generation(struct smacktrans_ctx *ctx)
+{
+	refresh(ctx);
+	return __atomic_load_n(&ctx->generation, __ATOMIC_ACQUIRE);
+}
+
+static int copyrule(struct smack_transrules *rules, int deny,
+                    smacklabel_id_t sub, smacklabel_id_t obj)
+{
+	smacklabel_id_t *to;
+
+	if (!sub || !obj)
+		return -1;
+	if (deny)
+		to = rules->denies + 2 * rules->ndenies++;
+	else
+		to = rules->pairs + 2 * rules->count++;
+	to[0] = sub;
+	to[1] = obj;
+	return 0;
+}
+
+static int copyrules(const snapshot_t *snap, struct smack_transrules *rules)
+{
+	const transdb_slot_t *slots;
+	size_t i, total;
+
+	if (!snap)
+		return 0;
+	total = snap->db ? snap->db->rules : snap->count;
+	rules->pairs = (smacklabel_id_t*)malloc(2 * sizeof(*rules->pairs) * (total + 1));
+	rules->denies = (smacklabel_id_t*)malloc(2 * sizeof(*rules->denies) * (total + 1));
+	if (!rules->pairs || !rules->denies)
+		return -1;
+	if (snap->db) {
+		slots = dbslots(snap->db);
+		for (i = 0; i < snap->db->slots; ++i) {
+			if (slots[i].subject &&
+			    copyrule(rules, slots[i].flags & TRANSDB_DENY,
+			             smack_intern(dblabels(snap->db) + slots[i].subject),
+			             smack_intern(dblabels(snap->db) + slots[i].object)) != 0)
+				return -1;
 		}
+	} else {
+		for (i = 0; i < snap->size; ++i) {
+			if (snap->pairs[i])
+				copyrule(rules, !!(snap->pairs[i] & PAIR_DENY),
+				         pairsub(snap->pairs[i]), pairobj(snap->pairs[i]));
+		}
+	}
 
-		closedir(dir);
-	} while(0);
-#endif
+	if (snap->nodes) {
+		rules->trie = (trienode_t*)malloc(snap->nodes * sizeof(*rules->trie));
+		if (!rules->trie)
+			return -1;
+		memcpy(rules->trie, snap->trie, snap->nodes * sizeof(*rules->trie));
+		rules->nodes = snap->nodes;
+	}
+	return 0;
+}
 
-	return forbidden ? 0 : allowed;
+int smack_trans_rules(struct smacktrans_ctx *ctx, struct smack_transrules *rules)
+{
+	int rc;
+
+	memset(rules, 0, sizeof(*rules));
+	rules->generation = smack_trans_generation(ctx);
+	if (smack_epoch_enter() != 0) {
+		pthread_mutex_lock(&ctx->lock);
+		rc = copyrules(__atomic_load_n(&ctx->snapshot, __ATOMIC_ACQUIRE), rules);
+		pthread_mutex_unlock(&ctx->lock);
+	} else {
+		rc = copyrules(__atomic_load_n(&ctx->snapshot, __ATOMIC_ACQUIRE), rules);
+		smack_epoch_leave();
+	}
+	if (rc != 0) {
+		smack_trans_freerules(rules);
+		errno = ENOMEM;
+		return -1;
+	}
+	return 0;
+}
+
+void smack_trans_freerules(struct smack_transrules *rules)
+{
+	free(rules->pairs);
+	free(rules->denies);
+	free(rules->trie);
+	memset(rules, 0, sizeof(*rules));
 }
@@ -0,0 +1,140 @@
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+
+#include "smack.h"
+
+static struct option lopts[] = {
+	{ "help",      no_argument,       NULL, 'h' },
+	{ "file",      required_argument, NULL, 'f' },
+	{ "dir",       required_argument, NULL, 'd' },
+	{ "label",     required_argument, NULL, 'l' },
+
+	{ NULL, 0, NULL, 0 }
+};
+
+static void usage(const char *arg0, FILE *target, int exitstatus)
+{
+	fprintf(target, "usage: %s [options] [target]\n", arg0);
+	fprintf(target,
+	"options:\n"
+	"  -h, --help            show this help message\n"
+	"  -f, --file=path       read rules from this file instead of\n"
+	"                        " SMACK_TRANSITION_FILE "\n"
+	"  -d, --dir=path        read rules from the files in this directory\n"
+	"                        instead of " SMACK_TRANSITION_DIR "\n"
+	"  -l, --label=label     only list the labels reachable from label, or\n"
+	"                        check if it can reach the target\n"
+	);
+	exit(exitstatus);
+}
+
+static const char *opt_file = NULL;
+static const char *opt_dir = NULL;
+static const char *opt_label = NULL;
+static const char *opt_target = NULL;
+
+static void checkargs(int argc, char **argv)
+{
+	int o;
+	int lind = 0;
+
+	while ( (o = getopt_long(argc, argv, "+hf:d:l:", lopts, &lind)) != -1 ) {
+		switch (o)
+		{
+			case 'h':
+				usage(argv[0], stdout, 0);
+				break;
+			case 'f':
+				opt_file = optarg;
+				break;
+			case 'd':
+				opt_dir = optarg;
+				break;
+			case 'l':
+				opt_label = optarg;
+				break;
+			default:
+				usage(argv[0], stderr, 1);
+				break;
+		};
+	}
+
+	if (optind + 1 == argc && opt_label)
+		opt_target = argv[optind++];
+	if (optind != argc)
+		usage(argv[0], stderr, 1);
+}
+
+static smacklabel_id_t *ids = NULL;
+static size_t max = 0;
+
+// Print the labels reachable from a label on one line.
+static int dump(const char *arg0, struct smackreach *reach, const char *label)
+{
+	size_t count, i;
+
+	for (;;) {
+		count = smackreach_list(reach, label, ids, max);
+		if (count <= max)
+			break;
+		free(ids);
+		max = count;
+		ids = (smacklabel_id_t*)malloc(sizeof(*ids) * max);
+		if (!ids) {
+			fprintf(stderr, "%s: out of memory\n", arg0);
+			return -1;
+		}
+	}
+
+	printf("%s:", label);
+	for (i = 0; i < count; ++i)
+		printf(" %s", smack_labelname(ids[i]));
+	printf("\n");
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct smacktrans_ctx *ctx;
+	struct smackreach *reach;
+	smacklabel_id_t *labels;
+	size_t count, i;
+
+	checkargs(argc, argv);
+
+	ctx = smacktrans_open(opt_file, opt_dir);
+	if (!ctx || !(reach = smackreach_open(ctx))) {
+		fprintf(stderr, "%s: failed to read the transition rules: %s\n",
+		        argv[0], strerror(errno));
+		return 1;
+	}
+
+	if (opt_target)
+		return smackreach_check(reach, opt_label, opt_target) ? 0 : 2;
+	if (opt_label)
+		return dump(argv[0], reach, opt_label) ? 1 : 0;
+
+	// the whole closure, one label per line
+	count = smackreach_labels(reach, NULL, 0);
+	labels = (smacklabel_id_t*)malloc(sizeof(*labels) * (count + 1));
+	if (!labels) {
+		fprintf(stderr, "%s: out of memory\n", argv[0]);
+		return 1;
+	}
+	i = smackreach_labels(reach, labels, count);
+	if (i < count)
+		count = i;
+	for (i = 0; i < count; ++i)
+		if (dump(argv[0], reach, smack_labelname(labels[i])) != 0)
+			return 1;
+
+	free(labels);
+	free(ids);
+	smackreach_close(reach);
+	smacktrans_close(ctx);
+	return 0;
+}
@@ -65,6 +65,9 @@ int main(int argc, char **argv)
 
 	label = argv[1];
 
+	// share access decisions with other runs, if root set up a cache
+	smackshmcache_attach(NULL, 0, 0);
+
 	if (!strcmp(label, "-r") || !strcmp(label, "--remove"))
 		remove_label = 1;
 	else if (!sanelabel(label)) {
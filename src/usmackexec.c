@@ -157,6 +157,9 @@ int main(int argc, char **argv, char **envp)
 	}
 	mylabel[rc] = 0;
 
+	// share access decisions with other runs, if root set up a cache
+	smackshmcache_attach(NULL, 0, 0);
+
 	if (label) {
 		if (strlen(label) >= SMACK_LONGLABEL-1) {
 			fprintf(stderr, "%s: label '%s' exceeds length of %d\n",
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/smackint.h"
+
+/* smack_builtin() against the kernel's builtin rules, as documented in
+ * Documentation/security/Smack.txt:
+ *   1. a subject labeled "*" is denied any access,
+ *   2. a request with equal labels is allowed,
+ *   3. an object labeled "*" allows any access,
+ *   4. a read or execute request on an object labeled "_" is allowed,
+ *   5. a read or execute request by a subject labeled "^" is allowed,
+ * in this order. Anything else is up to the rule list, so the kernel
+ * has to be asked, as it has to for invalid labels, which it rejects.
+ */
+
+#define D -1 // deferred to the kernel
+
+#define L16 "LLLLLLLLLLLLLLLL"
+#define L64 L16 L16 L16 L16
+static const char long255[] = L64 L64 L64 L16 L16 L16 "LLLLLLLLLLLLLLL";
+static const char long256[] = L64 L64 L64 L64;
+
+static const struct {
+	const char *request;
+	int         may;
+} requests[] = {
+	{ "",      0 },
+	{ "r",     SMACK_MAY_R },
+	{ "w",     SMACK_MAY_W },
+	{ "x",     SMACK_MAY_X },
+	{ "a",     SMACK_MAY_A },
+	{ "t",     SMACK_MAY_T },
+	{ "rx",    SMACK_MAY_R | SMACK_MAY_X },
+	{ "rw",    SMACK_MAY_R | SMACK_MAY_W },
+	{ "rwxat", SMACK_MAY_ALL },
+};
+
+#define NREQUESTS (sizeof(requests) / sizeof(requests[0]))
+
+static const struct {
+	const char *subject;
+	const char *object;
+	int         expect[NREQUESTS]; // "", r, w, x, a, t, rx, rw, rwxat
+} cases[] = {
+	// 1. the star subject, before everything else
+	{ "*",   "a",   { 0, 0, 0, 0, 0, 0, 0, 0, 0 } },
+	{ "*",   "*",   { 0, 0, 0, 0, 0, 0, 0, 0, 0 } },
+	{ "*",   "_",   { 0, 0, 0, 0, 0, 0, 0, 0, 0 } },
+	{ "*",   "^",   { 0, 0, 0, 0, 0, 0, 0, 0, 0 } },
+	// 2. equal labels
+	{ "a",   "a",   { 1, 1, 1, 1, 1, 1, 1, 1, 1 } },
+	{ "_",   "_",   { 1, 1, 1, 1, 1, 1, 1, 1, 1 } },
+	{ "^",   "^",   { 1, 1, 1, 1, 1, 1, 1, 1, 1 } },
+	{ "System", "System", { 1, 1, 1, 1, 1, 1, 1, 1, 1 } },
+	// 3. the star object
+	{ "a",   "*",   { 1, 1, 1, 1, 1, 1, 1, 1, 1 } },
+	{ "_",   "*",   { 1, 1, 1, 1, 1, 1, 1, 1, 1 } },
+	{ "^",   "*",   { 1, 1, 1, 1, 1, 1, 1, 1, 1 } },
+	// 4. the floor object, only for reading and executing
+	{ "a",   "_",   { 1, 1, D, 1, D, D, 1, D, D } },
+	{ "^",   "_",   { 1, 1, D, 1, D, D, 1, D, D } },
+	// 5. the hat subject, only for reading and executing
+	{ "^",   "a",   { 1, 1, D, 1, D, D, 1, D, D } },
+	{ "^",   "System", { 1, 1, D, 1, D, D, 1, D, D } },
+	// none of the builtin rules
+	{ "a",   "b",   { D, D, D, D, D, D, D, D, D } },
+	{ "_",   "a",   { D, D, D, D, D, D, D, D, D } },
+	{ "a",   "^",   { D, D, D, D, D, D, D, D, D } },
+	{ "_",   "^",   { D, D, D, D, D, D, D, D, D } },
+	{ "ab",  "a",   { D, D, D, D, D, D, D, D, D } },
+	{ "a",   "ab",  { D, D, D, D, D, D, D, D, D } },
+	{ "**",  "a",   { D, D, D, D, D, D, D, D, D } },
+	{ "a",   "**",  { D, D, D, D, D, D, D, D, D } },
+	{ "a",   "__",  { D, D, D, D, D, D, D, D, D } },
+	{ "^^",  "a",   { D, D, D, D, D, D, D, D, D } },
+	// the internet label depends on the kernel's version
+	{ "@",   "a",   { D, D, D, D, D, D, D, D, D } },
+	{ "a",   "@",   { D, D, D, D, D, D, D, D, D } },
+	// invalid labels, even equal ones
+	{ "",    "",    { D, D, D, D, D, D, D, D, D } },
+	{ "",    "*",   { D, D, D, D, D, D, D, D, D } },
+	{ "*",   "",    { D, D, D, D, D, D, D, D, D } },
+	{ "a b", "a b", { D, D, D, D, D, D, D, D, D } },
+	{ "a/b", "a/b", { D, D, D, D, D, D, D, D, D } },
+	{ "-a",  "-a",  { D, D, D, D, D, D, D, D, D } },
+	{ "a\"", "_",   { D, D, D, D, D, D, D, D, D } },
+	{ "^",   "a'",  { D, D, D, D, D, D, D, D, D } },
+	{ long255, long255, { 1, 1, 1, 1, 1, 1, 1, 1, 1 } },
+	{ long256, long256, { D, D, D, D, D, D, D, D, D } },
+	{ long256, "*", { D, D, D, D, D, D, D, D, D } },
+};
+
+int main(void)
+{
+	size_t i, j;
+	int failures = 0;
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+		for (j = 0; j < NREQUESTS; ++j) {
+			const char *sub = cases[i].subject;
+			const char *obj = cases[i].object;
+			int rc = smack_builtin(sub, strlen(sub), obj, strlen(obj),
+			                       requests[j].may);
+			if (rc != cases[i].expect[j]) {
+				fprintf(stderr, "builtin: %s %s \"%s\" is %d, expected %d\n",
+				        sub, obj, requests[j].request, rc, cases[i].expect[j]);
+				++failures;
+			}
+		}
+	}
+	if (failures)
+		fprintf(stderr, "builtin: %d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,144 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "../src/smackint.h"
+
+/* Reloading the transition rules only parses the files which changed.
+ * Files get explicit modification times well in the past, as files
+ * written within the last two seconds are read again on purpose.
+ */
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		++failures; \
+	} \
+} while (0)
+
+static char tmpdir[] = "/tmp/transreloadXXXXXX";
+static char file[48], dir[48];
+
+static void writefile(const char *path, const char *rules, time_t mtime)
+{
+	struct timespec times[2];
+	FILE *fp = fopen(path, "w");
+
+	if (!fp) {
+		perror(path);
+		exit(1);
+	}
+	fputs(rules, fp);
+	fclose(fp);
+	times[0].tv_sec = times[1].tv_sec = mtime;
+	times[0].tv_nsec = times[1].tv_nsec = 0;
+	if (utimensat(AT_FDCWD, path, times, 0) != 0) {
+		perror(path);
+		exit(1);
+	}
+}
+
+static void subpath(char *out, const char *name)
+{
+	snprintf(out, 64, "%s/%s", dir, name);
+}
+
+// The files parsed by a reload.
+static unsigned long reloadparses(struct smacktrans_ctx *ctx)
+{
+	unsigned long before = smack_trans_parses;
+
+	CHECK(smacktrans_reload(ctx) == 0);
+	return smack_trans_parses - before;
+}
+
+int main(void)
+{
+	struct smacktrans_ctx *ctx;
+	char a[64], b[64];
+	time_t past = time(NULL) - 3600;
+	unsigned long before;
+
+	if (!mkdtemp(tmpdir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(file, sizeof(file), "%s/transition", tmpdir);
+	snprintf(dir, sizeof(dir), "%s/transition.d", tmpdir);
+	if (mkdir(dir, 0755) != 0) {
+		perror(dir);
+		return 1;
+	}
+	subpath(a, "a");
+	subpath(b, "b");
+	writefile(file, "main -> one\n", past);
+	writefile(a, "a -> one\n", past);
+	writefile(b, "b -> one\n", past);
+
+	ctx = smacktrans_open(file, dir);
+	CHECK(ctx != NULL);
+	if (!ctx)
+		return 1;
+
+	// the first check reads everything
+	before = smack_trans_parses;
+	CHECK(smacktrans_check(ctx, "a", "one") == 1);
+	CHECK(smack_trans_parses - before == 3);
+
+	// an unchanged configuration is never parsed again
+	before = smack_trans_parses;
+	CHECK(smacktrans_check(ctx, "b", "one") == 1);
+	CHECK(smacktrans_check(ctx, "main", "one") == 1);
+	CHECK(smack_trans_parses == before);
+	CHECK(reloadparses(ctx) == 0);
+	CHECK(reloadparses(ctx) == 0);
+
+	// a single changed file is parsed once
+	writefile(a, "a -> two\n", past + 1);
+	CHECK(reloadparses(ctx) == 1);
+	CHECK(smacktrans_check(ctx, "a", "two") == 1);
+	CHECK(smacktrans_check(ctx, "a", "one") == 0);
+	CHECK(reloadparses(ctx) == 0);
+
+	// a new file is parsed once, a removed one not at all
+	subpath(a, "c");
+	writefile(a, "c -> one\n", past);
+	CHECK(reloadparses(ctx) == 1);
+	CHECK(smacktrans_check(ctx, "c", "one") == 1);
+	CHECK(unlink(a) == 0);
+	CHECK(reloadparses(ctx) == 0);
+	CHECK(smacktrans_check(ctx, "c", "one") == 0);
+
+	// a modification time in the future does not make a file racy
+	writefile(b, "b -> three\n", time(NULL) + 3600);
+	CHECK(reloadparses(ctx) == 1);
+	CHECK(reloadparses(ctx) == 0);
+	CHECK(smacktrans_check(ctx, "b", "three") == 1);
+
+	// a file written just now is read once more, then no more
+	writefile(b, "b -> four\n", time(NULL));
+	CHECK(reloadparses(ctx) == 1);
+	sleep(2);
+	CHECK(reloadparses(ctx) == 1);
+	CHECK(reloadparses(ctx) == 0);
+	CHECK(smacktrans_check(ctx, "b", "four") == 1);
+
+	smacktrans_close(ctx);
+	unlink(file);
+	unlink(b);
+	subpath(a, "a");
+	unlink(a);
+	rmdir(dir);
+	rmdir(tmpdir);
+
+	if (failures)
+		fprintf(stderr, "transreload: %d checks failed\n", failures);
+	return failures ? 1 : 0;
+}